@@ -0,0 +1,337 @@
+#include "compiled_regex.h"
+#include "matcher.h"
+#include "resource_limits.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// hunts for pattern/input pairs that make the matcher crawl. every fuzz
+// input gets decoded into a pattern, generated from the grammar parse()
+// accepts so next to nothing gets thrown away, and an input made of the
+// pattern's own chars repeated over and over, which is what the slow cases
+// tend to look like.
+//
+// with libFuzzer (clang only):
+//   make fuzz
+//   build/perf_fuzz.out -max_len=256 fuzz/corpus
+// what every run cost goes into libFuzzer's extra counters, one per power
+// of two of every metric, so an input slower than anything before it counts
+// as new coverage and gets kept. with PERF_FUZZ_MAX_STEPS_PER_BYTE set,
+// anything past it is reported as a crash and saved as one.
+//
+// make perf_replay builds the same thing as a plain program, with any
+// compiler, that runs every file it gets once and prints what it cost. run
+// over fuzz/corpus, the worst cases found so far, that's the regression
+// benchmark
+
+static_assert(STATS_ENABLED, "the perf fuzzer needs -DREGEX_STATS=1");
+
+namespace {
+
+// small, so the pieces of a pattern overlap a lot
+constexpr std::string_view LITERALS = "abc";
+constexpr std::string_view RESERVED_SETS = "dwsDWS";
+// what the input gets built from, mostly the literals again
+constexpr std::string_view INPUT_CHARS = "aaabbbcccz_ \n";
+constexpr size_t MAX_DEPTH = 4;
+constexpr size_t MAX_INPUT_BYTES = 64 << 10;
+constexpr size_t MAX_STATES = 1 << 14;
+// a scan stops past this many steps per byte, so a single slow case can't
+// stall the whole run. hitting it is a finding in itself
+constexpr size_t STEP_CAP_PER_BYTE = 1 << 12;
+
+// hands out the fuzz input a byte at a time, zeroes once it runs out
+class ByteReader {
+    std::string_view data;
+    size_t pos = 0;
+
+  public:
+    explicit ByteReader(std::string_view init_data) : data(init_data) {
+    }
+
+    uint8_t next() {
+        return pos < data.size() ? (uint8_t)data[pos++] : 0;
+    }
+
+    std::string_view rest() const {
+        return data.substr(std::min(pos, data.size()));
+    }
+};
+
+// every byte picks one production, and running out of bytes always picks
+// the shortest one, so every input decodes to a finite, valid pattern
+class PatternGenerator {
+    ByteReader &reader;
+    std::string pattern;
+
+    void literal() {
+        pattern.push_back(LITERALS[reader.next() % LITERALS.size()]);
+    }
+
+    void set() {
+        pattern.push_back('[');
+        if (reader.next() % 4 == 0) {
+            pattern.push_back('^');
+        }
+        size_t members = 1 + reader.next() % 3;
+        for (size_t idx = 0; idx < members; ++idx) {
+            literal();
+            if (reader.next() % 4 == 0) {
+                pattern.push_back('-');
+                literal();
+            }
+        }
+        pattern.push_back(']');
+    }
+
+    void modifier() {
+        switch (reader.next() % 5) {
+        case 2:
+            pattern.push_back('*');
+            break;
+        case 3:
+            pattern.push_back('+');
+            break;
+        case 4:
+            pattern.push_back('?');
+            break;
+        default:
+            break;
+        }
+    }
+
+    void atom(size_t depth) {
+        switch (reader.next() % 12) {
+        case 4:
+            pattern.push_back('.');
+            break;
+        case 5:
+            set();
+            break;
+        case 6:
+            pattern.push_back('\\');
+            pattern.push_back(
+                RESERVED_SETS[reader.next() % RESERVED_SETS.size()]);
+            break;
+        case 7:
+            // assertions take no modifier
+            pattern.append(
+                std::array{"^", "$", "\\b", "\\B"}[reader.next() % 4]);
+            return;
+        case 8:
+        case 9:
+            if (depth < MAX_DEPTH) {
+                pattern.push_back('(');
+                alternation(depth + 1);
+                pattern.push_back(')');
+                break;
+            }
+            literal();
+            break;
+        default:
+            literal();
+        }
+        modifier();
+    }
+
+    void sequence(size_t depth) {
+        size_t atoms = 1 + reader.next() % 4;
+        for (size_t idx = 0; idx < atoms; ++idx) {
+            atom(depth);
+        }
+    }
+
+    void alternation(size_t depth) {
+        sequence(depth);
+        while (reader.next() % 4 == 3) {
+            pattern.push_back('|');
+            sequence(depth);
+        }
+    }
+
+  public:
+    explicit PatternGenerator(ByteReader &init_reader) : reader(init_reader) {
+    }
+
+    std::string generate() {
+        alternation(0);
+        return pattern;
+    }
+};
+
+struct FuzzCase {
+    std::string pattern;
+    std::string input;
+};
+
+// [repeats][pattern productions...][input seed...]
+FuzzCase decode(std::string_view data) {
+    ByteReader reader(data);
+    size_t repeats = 1 + (size_t)reader.next() * reader.next();
+    FuzzCase fuzz_case;
+    fuzz_case.pattern = PatternGenerator(reader).generate();
+
+    std::string chunk;
+    for (char c : reader.rest()) {
+        chunk.push_back(INPUT_CHARS[(uint8_t)c % INPUT_CHARS.size()]);
+    }
+    if (chunk.empty()) {
+        chunk = LITERALS.substr(0, 1);
+    }
+    while (repeats-- > 0 && fuzz_case.input.size() < MAX_INPUT_BYTES) {
+        fuzz_case.input.append(chunk);
+    }
+    return fuzz_case;
+}
+
+struct Cost {
+    size_t compiled_states = 0;
+    size_t input_size = 0;
+    // states stepped, one per thread per byte for the lazy dfa
+    size_t steps = 0;
+    size_t peak_threads = 0;
+    // every (start, end) pair gets reported, so .+ over n bytes makes n^2/2
+    // of them. that's where the time goes then, not in the steps
+    size_t matches = 0;
+    uint64_t scan_ns = 0;
+    bool hit_limit = false;
+
+    size_t steps_per_byte() const {
+        return steps / std::max<size_t>(input_size, 1);
+    }
+};
+
+// nullopt for patterns that don't compile for any reason but their size
+std::optional<Cost> measure(FuzzCase const &fuzz_case) {
+    Cost cost;
+    cost.input_size = fuzz_case.input.size();
+    CompiledRegexPtr regex;
+    try {
+        regex = compile_regex(fuzz_case.pattern, {.max_states = MAX_STATES});
+    } catch (LimitError const &) {
+        cost.compiled_states = MAX_STATES;
+        cost.hit_limit = true;
+        return cost;
+    } catch (std::runtime_error const &) {
+        return {};
+    }
+    cost.compiled_states = regex->get_table().size();
+
+    ScanOptions options;
+    options.max_steps = (cost.input_size + 1) * STEP_CAP_PER_BYTE;
+    Scanner scanner(regex, {}, options);
+    try {
+        cost.matches = scanner.count(fuzz_case.input);
+    } catch (LimitError const &) {
+        cost.hit_limit = true;
+    }
+    // the counters are kept up to date while scanning, a throw included
+    auto const &stats = scanner.last_match_stats();
+    cost.steps = stats.states_touched;
+    cost.peak_threads = stats.peak_active_threads;
+    cost.scan_ns = stats.scan_ns;
+    return cost;
+}
+
+std::ostream &operator<<(std::ostream &os, Cost const &cost) {
+    os << cost.input_size << " bytes, " << cost.compiled_states
+       << " states, " << cost.steps_per_byte() << " steps/byte, "
+       << cost.peak_threads << " peak threads, " << cost.matches
+       << " matches, " << cost.scan_ns / 1000
+       << " us";
+    if (cost.hit_limit) {
+        os << ", hit a limit";
+    }
+    return os;
+}
+
+} // namespace
+
+#ifndef PERF_FUZZ_REPLAY
+
+namespace {
+
+// libFuzzer counts every nonzero byte in this section as a feature
+__attribute__((used, section("__libfuzzer_extra_counters")))
+uint8_t cost_counters[3][64];
+
+size_t bucket(size_t value) {
+    return std::min<size_t>((size_t)std::bit_width(value), 63);
+}
+
+size_t max_steps_per_byte() {
+    static size_t const max = [] {
+        char const *env = getenv("PERF_FUZZ_MAX_STEPS_PER_BYTE");
+        return env != nullptr ? (size_t)strtoull(env, nullptr, 10) : 0;
+    }();
+    return max;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size) {
+    FuzzCase fuzz_case = decode({(char const *)data, size});
+    auto cost = measure(fuzz_case);
+    if (!cost) {
+        return 0;
+    }
+    cost_counters[0][bucket(cost->steps_per_byte())] = 1;
+    cost_counters[1][bucket(cost->peak_threads)] = 1;
+    cost_counters[2][bucket(cost->compiled_states)] = 1;
+
+    static size_t worst_steps_per_byte = 0;
+    if (cost->steps_per_byte() > worst_steps_per_byte) {
+        worst_steps_per_byte = cost->steps_per_byte();
+        std::cerr << "worst so far: /" << fuzz_case.pattern << "/ " << *cost
+                  << std::endl;
+    }
+    if (max_steps_per_byte() != 0 &&
+        (cost->hit_limit || cost->steps_per_byte() > max_steps_per_byte())) {
+        std::cerr << "too slow: /" << fuzz_case.pattern << "/ " << *cost
+                  << std::endl;
+        abort();
+    }
+    return 0;
+}
+
+#else
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " corpus_file..." << std::endl;
+        return 2;
+    }
+    int status = 0;
+    for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+        std::ifstream file(argv[arg_idx], std::ios::binary);
+        if (!file) {
+            std::cerr << argv[arg_idx] << ": can't read" << std::endl;
+            status = 2;
+            continue;
+        }
+        std::string data{std::istreambuf_iterator<char>(file), {}};
+        FuzzCase fuzz_case = decode(data);
+        auto cost = measure(fuzz_case);
+        std::cout << argv[arg_idx] << ": /" << fuzz_case.pattern << "/ ";
+        if (cost) {
+            std::cout << *cost << std::endl;
+        } else {
+            std::cout << "doesn't compile" << std::endl;
+        }
+    }
+    return status;
+}
+
+#endif
@@ -0,0 +1,406 @@
+#pragma once
+
+#include "TransitionTable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// the finalized form of a TransitionTable. states are renumbered densely
+// from 0, breadth first from the starting states, and every row, the
+// starting states and the accepting states are packed into a single
+// allocation, so copying is one memcpy and teardown is one free. rows are
+// indexed by byte class rather than by char
+class CompactTable {
+  public:
+    using StateId = uint32_t;
+    static constexpr size_t ALPHABET = 128;
+
+    // what every state is, looked up once per state per byte by the matcher
+    static constexpr uint32_t ACCEPTING_FLAG = 1;
+    // some path from it, on anything at all, ends up accepting
+    static constexpr uint32_t LIVE_FLAG = 2;
+
+  private:
+    // layout of storage:
+    // [row offsets: states * classes + 1][targets][starting][accepting]
+    // [flags: states]
+    // the targets of (s, c) are targets[offsets[s * classes + k],
+    //                                   offsets[s * classes + k + 1])
+    // where k = byte_classes[c]
+    std::vector<uint32_t> storage;
+    // chars every state treats the same share a class, and rows only have
+    // a column per class. a case insensitive pattern gets 'a' and 'A' in the
+    // same class, so it costs no more than a case sensitive one
+    std::array<uint8_t, ALPHABET> byte_classes{};
+    size_t num_classes = 0;
+    // whether any state moves on \b or \B
+    bool boundaries = false;
+    size_t num_states = 0;
+    size_t targets_begin = 0;
+    size_t starting_begin = 0;
+    size_t accepting_begin = 0;
+    size_t flags_begin = 0;
+
+    std::span<StateId const> section(size_t begin, size_t end) const {
+        return {storage.data() + begin, end - begin};
+    }
+
+    // every state reachable from the starting states, breadth first. the
+    // states every thread begins in come first, the ones a byte away from
+    // them next and so on, so the rows touched on every byte sit together
+    std::vector<StateId> breadth_first_order() const {
+        std::vector<StateId> order;
+        std::vector<bool> seen(num_states);
+        auto visit = [&order, &seen](StateId s) {
+            if (!seen[s]) {
+                seen[s] = true;
+                order.push_back(s);
+            }
+        };
+        for (auto s : starting_states()) {
+            visit(s);
+        }
+        for (size_t head = 0; head < order.size(); ++head) {
+            for (auto target : all_transitions(order[head])) {
+                visit(target);
+            }
+        }
+        return order;
+    }
+
+    // renumbers the states so that state order[s] becomes s. states left
+    // out of order are dropped, nothing kept may move into them
+    void permute(std::vector<StateId> const &order) {
+        constexpr StateId DROPPED = std::numeric_limits<StateId>::max();
+        std::vector<StateId> old_to_new(num_states, DROPPED);
+        for (size_t s = 0; s < order.size(); ++s) {
+            old_to_new[order[s]] = (StateId)s;
+        }
+
+        size_t new_states = order.size();
+        size_t new_targets_begin = new_states * num_classes + 1;
+        std::vector<uint32_t> packed(new_targets_begin);
+        for (size_t s = 0; s < new_states; ++s) {
+            for (size_t k = 0; k < num_classes; ++k) {
+                packed[s * num_classes + k] =
+                    (uint32_t)(packed.size() - new_targets_begin);
+                size_t cell_begin = packed.size();
+                for (auto target : get_class_transition(order[s], k)) {
+                    packed.push_back(old_to_new[target]);
+                }
+                std::sort(packed.begin() + (ptrdiff_t)cell_begin,
+                          packed.end());
+            }
+        }
+        packed[new_states * num_classes] =
+            (uint32_t)(packed.size() - new_targets_begin);
+
+        size_t new_starting_begin = packed.size();
+        for (auto s : starting_states()) {
+            packed.push_back(old_to_new[s]);
+        }
+        size_t new_accepting_begin = packed.size();
+        for (auto s : accepting_states()) {
+            if (old_to_new[s] != DROPPED) {
+                packed.push_back(old_to_new[s]);
+            }
+        }
+        size_t new_flags_begin = packed.size();
+        for (auto s : order) {
+            packed.push_back(storage[flags_begin + s]);
+        }
+
+        storage = std::move(packed);
+        num_states = new_states;
+        targets_begin = new_targets_begin;
+        starting_begin = new_starting_begin;
+        accepting_begin = new_accepting_begin;
+        flags_begin = new_flags_begin;
+    }
+
+  public:
+    CompactTable() = default;
+
+    explicit CompactTable(TransitionTable const &table) {
+        // construction order keeps the numbering deterministic
+        std::vector<size_t> old_ids;
+        old_ids.reserve(table.table.size());
+        for (auto const &state_row : table.table) {
+            old_ids.push_back(state_row.first.state_idx);
+        }
+        std::sort(old_ids.begin(), old_ids.end());
+
+        std::unordered_map<size_t, StateId> old_to_new;
+        for (size_t idx = 0; idx < old_ids.size(); ++idx) {
+            old_to_new.insert({old_ids[idx], (StateId)idx});
+        }
+        auto renumber = [&old_to_new](TransitionTable::State const &s) {
+            return old_to_new.at(s.state_idx);
+        };
+
+        // the sorted targets of every (state, char)
+        num_states = old_ids.size();
+        std::vector<std::vector<StateId>> cells(num_states * ALPHABET);
+        for (size_t new_id = 0; new_id < num_states; ++new_id) {
+            auto const &row =
+                table.table.at(TransitionTable::State(old_ids[new_id]));
+            for (size_t c = 0; c < ALPHABET; ++c) {
+                auto &cell = cells[new_id * ALPHABET + c];
+                std::transform(row.row[c].begin(), row.row[c].end(),
+                               std::back_inserter(cell), renumber);
+                std::sort(cell.begin(), cell.end());
+                cell.erase(std::unique(cell.begin(), cell.end()), cell.end());
+            }
+        }
+
+        // a state is live if it accepts or moves to a live one. nothing can
+        // ever match once a thread is only in dead states, so the edges into
+        // them go and the matcher drops such a thread on the spot
+        std::vector<uint32_t> flags(num_states, 0);
+        for (auto const &acc : table.accepting_states) {
+            flags[renumber(acc)] |= ACCEPTING_FLAG | LIVE_FLAG;
+        }
+        std::vector<std::vector<StateId>> sources(num_states);
+        for (size_t s = 0; s < num_states; ++s) {
+            for (size_t c = 0; c < ALPHABET; ++c) {
+                for (auto target : cells[s * ALPHABET + c]) {
+                    sources[target].push_back((StateId)s);
+                }
+            }
+        }
+        std::vector<StateId> live_queue;
+        for (size_t s = 0; s < num_states; ++s) {
+            if (flags[s] & LIVE_FLAG) {
+                live_queue.push_back((StateId)s);
+            }
+        }
+        while (!live_queue.empty()) {
+            StateId s = live_queue.back();
+            live_queue.pop_back();
+            for (auto source : sources[s]) {
+                if (!(flags[source] & LIVE_FLAG)) {
+                    flags[source] |= LIVE_FLAG;
+                    live_queue.push_back(source);
+                }
+            }
+        }
+        for (auto &cell : cells) {
+            std::erase_if(cell, [&flags](StateId target) {
+                return !(flags[target] & LIVE_FLAG);
+            });
+        }
+
+        for (size_t s = 0; s < num_states; ++s) {
+            auto const *row = &cells[s * ALPHABET];
+            boundaries = boundaries ||
+                         !row[(size_t)WORD_BOUNDARY_SYMBOL].empty() ||
+                         !row[(size_t)NOT_WORD_BOUNDARY_SYMBOL].empty();
+        }
+
+        // two chars share a class when their columns are identical. the
+        // virtual symbols always get their own, the matcher and the analyzer
+        // look at them on their own. with boundaries around, a class also
+        // never mixes word and non-word chars, since whichever assertion
+        // holds before a byte depends on it
+        std::map<std::vector<StateId>, uint8_t> column_classes;
+        std::vector<size_t> class_chars;
+        for (size_t c = 0; c < ALPHABET; ++c) {
+            std::vector<StateId> column;
+            for (size_t s = 0; s < num_states; ++s) {
+                auto const &cell = cells[s * ALPHABET + c];
+                column.push_back((StateId)cell.size());
+                column.insert(column.end(), cell.begin(), cell.end());
+            }
+            if (boundaries) {
+                column.push_back(is_word_char((char)c));
+            }
+            bool anchor = is_virtual_symbol((char)c);
+            auto it = column_classes.find(column);
+            if (anchor || it == column_classes.end()) {
+                uint8_t new_class = (uint8_t)class_chars.size();
+                class_chars.push_back(c);
+                if (!anchor) {
+                    column_classes.insert({std::move(column), new_class});
+                }
+                byte_classes[c] = new_class;
+            } else {
+                byte_classes[c] = it->second;
+            }
+        }
+        num_classes = class_chars.size();
+
+        size_t num_targets = 0;
+        for (size_t s = 0; s < num_states; ++s) {
+            for (size_t c : class_chars) {
+                num_targets += cells[s * ALPHABET + c].size();
+            }
+        }
+
+        targets_begin = num_states * num_classes + 1;
+        starting_begin = targets_begin + num_targets;
+        accepting_begin = starting_begin + table.starting_states.size();
+        flags_begin = accepting_begin + table.accepting_states.size();
+        storage.resize(flags_begin + num_states);
+
+        size_t next_target = targets_begin;
+        for (size_t s = 0; s < num_states; ++s) {
+            for (size_t k = 0; k < num_classes; ++k) {
+                storage[s * num_classes + k] =
+                    (uint32_t)(next_target - targets_begin);
+                for (auto target : cells[s * ALPHABET + class_chars[k]]) {
+                    storage[next_target++] = target;
+                }
+            }
+        }
+        storage[num_states * num_classes] =
+            (uint32_t)(next_target - targets_begin);
+
+        std::transform(table.starting_states.begin(),
+                       table.starting_states.end(),
+                       storage.begin() + (ptrdiff_t)starting_begin, renumber);
+        std::transform(table.accepting_states.begin(),
+                       table.accepting_states.end(),
+                       storage.begin() + (ptrdiff_t)accepting_begin, renumber);
+        std::copy(flags.begin(), flags.end(),
+                  storage.begin() + (ptrdiff_t)flags_begin);
+
+        // construction order scatters a thread's next states all over the
+        // table. no thread can ever get into an unreachable state, so those
+        // go as well
+        permute(breadth_first_order());
+    }
+
+    // renumbers the states by how often visits says they were visited,
+    // most first, so the hottest rows share cache lines. ties keep their
+    // breadth first order. see count_state_visits() in table_profile.h
+    void place_hot_states_first(std::span<uint64_t const> visits) {
+        std::vector<StateId> order(num_states);
+        for (size_t s = 0; s < num_states; ++s) {
+            order[s] = (StateId)s;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [visits](StateId a, StateId b) {
+                             return visits[a] > visits[b];
+                         });
+        permute(order);
+    }
+
+    size_t size() const {
+        return num_states;
+    }
+
+    bool has_boundaries() const {
+        return boundaries;
+    }
+
+    size_t class_count() const {
+        return num_classes;
+    }
+
+    // expects c below ALPHABET
+    uint8_t byte_class(char c) const {
+        return byte_classes[(unsigned char)c];
+    }
+
+    std::span<StateId const> get_class_transition(StateId s,
+                                                  size_t byte_class) const {
+        size_t row_idx = s * num_classes + byte_class;
+        return section(targets_begin + storage[row_idx],
+                       targets_begin + storage[row_idx + 1]);
+    }
+
+    std::span<StateId const> get_transition(StateId s, char c) const {
+        unsigned char uc = (unsigned char)c;
+        if (uc >= ALPHABET) {
+            return {};
+        }
+        return get_class_transition(s, byte_classes[uc]);
+    }
+
+    // every target of s, once per class
+    std::span<StateId const> all_transitions(StateId s) const {
+        return section(targets_begin + storage[s * num_classes],
+                       targets_begin + storage[(s + 1) * num_classes]);
+    }
+
+    std::span<StateId const> starting_states() const {
+        return section(starting_begin, accepting_begin);
+    }
+
+    std::span<StateId const> accepting_states() const {
+        return section(accepting_begin, flags_begin);
+    }
+
+    bool is_accepting(StateId s) const {
+        return storage[flags_begin + s] & ACCEPTING_FLAG;
+    }
+
+    // no input can take s to an accepting state anymore. nothing moves
+    // into such a state, only a starting state can be one
+    bool is_dead(StateId s) const {
+        return !(storage[flags_begin + s] & LIVE_FLAG);
+    }
+
+    // adds every state reachable from states through symbol alone, which
+    // is how a thread takes the zero width assertions. returns whether
+    // anything got added
+    bool close_over(char symbol, std::vector<StateId> &states) const {
+        size_t old_size = states.size();
+        for (size_t idx = 0; idx < states.size(); ++idx) {
+            for (auto target : get_transition(states[idx], symbol)) {
+                if (std::find(states.begin(), states.end(), target) ==
+                    states.end()) {
+                    states.push_back(target);
+                }
+            }
+        }
+        return states.size() != old_size;
+    }
+
+    size_t memory_bytes() const {
+        return storage.size() * sizeof(uint32_t);
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &os, CompactTable const &tb) {
+    os << "starting states:" << std::endl;
+    for (auto s : tb.starting_states()) {
+        os << "{" << s << "}" << std::endl;
+    }
+    os << "============================" << std::endl;
+
+    os << "accepting states:" << std::endl;
+    for (auto s : tb.accepting_states()) {
+        os << "{" << s << "}" << std::endl;
+    }
+    os << "============================" << std::endl;
+    os << "table:" << std::endl;
+    for (CompactTable::StateId s = 0; s < tb.size(); ++s) {
+        os << "============================" << std::endl;
+        os << "state: {" << s << "}" << std::endl;
+        os << "row: ";
+        for (int16_t c = 0; c < 127; ++c) {
+            auto targets = tb.get_transition(s, (char)c);
+            if (targets.empty()) {
+                continue;
+            }
+            os << "char " << c << ": [";
+            for (auto t : targets) {
+                os << "{" << t << "}";
+            }
+            os << "]" << std::endl;
+        }
+        os << "============================" << std::endl;
+    }
+    return os;
+}
@@ -4,18 +4,70 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <iostream>
+#include <memory_resource>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+// inputs that never show up in text. the matcher feeds BOL to a fresh
+// thread at every line start, and checks EOL wherever a line ends
+inline constexpr char BOL_SYMBOL = 2;
+inline constexpr char EOL_SYMBOL = 3;
+// \b and \B sit between two bytes, so they never get fed. a thread follows
+// whichever of the two holds at its position before taking the next byte
+inline constexpr char WORD_BOUNDARY_SYMBOL = 4;
+inline constexpr char NOT_WORD_BOUNDARY_SYMBOL = 5;
+
+inline bool is_virtual_symbol(char c) {
+    return c == BOL_SYMBOL || c == EOL_SYMBOL || c == WORD_BOUNDARY_SYMBOL ||
+           c == NOT_WORD_BOUNDARY_SYMBOL;
+}
+
+// the same chars as \w
+inline bool is_word_char(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// the assertion that holds between two bytes. the ends of a line count as
+// non-word
+inline char boundary_symbol(bool prev_word, bool next_word) {
+    return prev_word != next_word ? WORD_BOUNDARY_SYMBOL
+                                  : NOT_WORD_BOUNDARY_SYMBOL;
+}
+
+// the table the TableBuilder combinators work on. everything in here
+// allocates through allocator_type, so a whole compilation can live in one
+// arena (see compile()) that gets thrown away once the table is compacted
 struct TransitionTable {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     struct State {
-        static size_t next_idx;
+        // every thread takes ids out of a block of its own, so the patterns
+        // compile_many() hands to different threads get states of their
+        // own without all of them bumping one counter. within a thread the
+        // ids still go up in construction order
+        static constexpr size_t IDS_PER_BLOCK = 4096;
+        static std::atomic<size_t> next_block;
         size_t state_idx;
 
+        static size_t fresh_idx() {
+            thread_local size_t next_idx = 0;
+            thread_local size_t block_end = 0;
+            if (next_idx == block_end) {
+                next_idx = next_block.fetch_add(IDS_PER_BLOCK,
+                                                std::memory_order_relaxed);
+                block_end = next_idx + IDS_PER_BLOCK;
+            }
+            return next_idx++;
+        }
+
         // should we really be doing this?
-        State() : state_idx(next_idx++){};
+        State() : state_idx(fresh_idx()){};
         State(size_t init_idx) : state_idx(init_idx){};
         ~State() = default;
 
@@ -56,18 +108,52 @@ struct TransitionTable {
 
     // maps each char to a list of states
     struct TransitionRow {
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+
         // 10 is reserved for EOL
         // 2 is reserved for BOL
-        std::array<std::vector<State>, 128> row;
+        std::array<std::pmr::vector<State>, 128> row;
+
+      private:
+        template <size_t... I>
+        static std::array<std::pmr::vector<State>, 128>
+        make_row(allocator_type alloc, std::index_sequence<I...>) {
+            return {((void)I, std::pmr::vector<State>(alloc))...};
+        }
+
+        template <size_t... I>
+        static std::array<std::pmr::vector<State>, 128>
+        copy_row(TransitionRow const &other, allocator_type alloc,
+                 std::index_sequence<I...>) {
+            return {std::pmr::vector<State>(other.row[I], alloc)...};
+        }
 
-        TransitionRow() {
+      public:
+        TransitionRow() : TransitionRow(allocator_type{}) {
         }
 
-        std::vector<State> &operator[](char index) {
+        explicit TransitionRow(allocator_type alloc)
+            : row(make_row(alloc, std::make_index_sequence<128>())) {
+        }
+
+        TransitionRow(TransitionRow const &other, allocator_type alloc)
+            : row(copy_row(other, alloc, std::make_index_sequence<128>())) {
+        }
+
+        TransitionRow(TransitionRow &&other, allocator_type alloc)
+            : TransitionRow(other, alloc) {
+        }
+
+        TransitionRow(TransitionRow const &other) = default;
+        TransitionRow(TransitionRow &&other) = default;
+        TransitionRow &operator=(TransitionRow const &other) = default;
+        TransitionRow &operator=(TransitionRow &&other) = default;
+
+        std::pmr::vector<State> &operator[](char index) {
             return row[(unsigned char)index];
         }
 
-        std::vector<State> const &operator[](char index) const {
+        std::pmr::vector<State> const &operator[](char index) const {
             return row[(unsigned char)index];
         }
 
@@ -75,8 +161,8 @@ struct TransitionTable {
             row[(unsigned char)transition_char].push_back(target);
         }
 
-        void add_parallel_transition(State const &target,
-                                     std::vector<State> const &new_targets) {
+        void add_parallel_transition(
+            State const &target, std::pmr::vector<State> const &new_targets) {
             // if for a char it contains target, we append new_targets to it
             for (size_t idx = 0; idx < 127; ++idx) {
                 if (auto it =
@@ -89,10 +175,11 @@ struct TransitionTable {
         }
     };
 
-    std::unordered_map<State, TransitionRow, State::Hash> table;
-    std::vector<State> starting_states;
-    std::vector<State> accepting_states;
+    std::pmr::unordered_map<State, TransitionRow, State::Hash> table;
+    std::pmr::vector<State> starting_states;
+    std::pmr::vector<State> accepting_states;
 
+    // only valid between tables that share an allocator
     friend void swap(TransitionTable &a, TransitionTable &b) {
         using std::swap;
         swap(a.table, b.table);
@@ -101,19 +188,28 @@ struct TransitionTable {
     }
 
     // empty string is accepting, anything else goes into rejection
-    TransitionTable()
-        : starting_states({State()}),
-          accepting_states({starting_states.front()}) {
+    TransitionTable() : TransitionTable(allocator_type{}) {
+    }
+
+    explicit TransitionTable(allocator_type alloc)
+        : table(alloc), starting_states({State()}, alloc),
+          accepting_states({starting_states.front()}, alloc) {
         // create the trivial row
-        table.insert({starting_states.front(), TransitionRow()});
+        table.insert({starting_states.front(), TransitionRow(alloc)});
     }
 
+    // the copy stays in the same arena as the original
     TransitionTable(TransitionTable const &other)
-        : starting_states(other.starting_states),
-          accepting_states(other.accepting_states) {
+        : TransitionTable(other, other.get_allocator()) {
+    }
+
+    TransitionTable(TransitionTable const &other, allocator_type alloc)
+        : table(alloc), starting_states(other.starting_states, alloc),
+          accepting_states(other.accepting_states, alloc) {
 
         // map the old states to the new states
-        std::unordered_map<State, State, State::Hash> old_to_new_states;
+        std::pmr::unordered_map<State, State, State::Hash> old_to_new_states(
+            alloc);
         for (auto const &state_pair : other.table) {
             old_to_new_states.insert({state_pair.first, State()});
         }
@@ -131,7 +227,10 @@ struct TransitionTable {
 
             auto const &new_state = old_to_new_states.at(row_pair.first);
 
-            table.insert({new_state, row_pair.second});
+            // piecewise so the row gets built straight into our allocator
+            table.emplace(std::piecewise_construct,
+                          std::forward_as_tuple(new_state),
+                          std::forward_as_tuple(row_pair.second));
             for (int16_t idx = 0; idx < 127; ++idx) {
                 std::for_each(table.at(new_state)[(char)idx].begin(),
                               table.at(new_state)[(char)idx].end(),
@@ -146,25 +245,29 @@ struct TransitionTable {
           accepting_states(std::move(other.accepting_states)) {
     }
 
+    // these can't swap: the two sides may sit in different arenas, so the
+    // members get moved over one by one instead
     TransitionTable &operator=(TransitionTable const &other) {
         if (this != &other) {
-            TransitionTable temp{other};
-
-            // using std::swap;
-            swap(*this, temp);
+            TransitionTable temp{other, get_allocator()};
+            *this = std::move(temp);
         }
         return *this;
     }
 
     TransitionTable &operator=(TransitionTable &&other) {
         if (this != &other) {
-            TransitionTable temp{std::move(other)};
-            using std::swap;
-            swap(*this, temp);
+            table = std::move(other.table);
+            starting_states = std::move(other.starting_states);
+            accepting_states = std::move(other.accepting_states);
         }
         return *this;
     }
 
+    allocator_type get_allocator() const {
+        return table.get_allocator();
+    }
+
     bool
     is_accepting(std::unordered_set<State, State::Hash> const &set_of_states) {
         return std::any_of(set_of_states.begin(), set_of_states.end(),
@@ -177,11 +280,12 @@ struct TransitionTable {
         return it != accepting_states.end();
     }
 
-    std::vector<State> const &get_transition(State curr_state, char c) const {
+    std::pmr::vector<State> const &get_transition(State curr_state,
+                                                  char c) const {
         return table.at(curr_state)[c];
     }
 };
-inline constinit size_t TransitionTable::State::next_idx = 0;
+inline constinit std::atomic<size_t> TransitionTable::State::next_block{0};
 
 inline std::ostream &operator<<(std::ostream &os,
                                 TransitionTable::State const &s) {
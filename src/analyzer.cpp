@@ -0,0 +1,244 @@
+#include "analyzer.h"
+
+#include <algorithm>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// appends the plain chars id is made of to literal, false if it's anything
+// but a run of them
+bool append_literal(Ast const &ast, Ast::NodeId id, std::string &literal) {
+    auto const &node = ast.node(id);
+    if (node.kind == Ast::Kind::CONCAT) {
+        for (auto child : ast.children(id)) {
+            if (!append_literal(ast, child, literal)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (node.kind != Ast::Kind::CHAR) {
+        return false;
+    }
+    // the anchor symbols, newlines and anything past the table width stay
+    // with the automaton
+    auto c = (unsigned char)node.value;
+    if (c == BOL_SYMBOL || c == EOL_SYMBOL || c == '\n' || c >= 128) {
+        return false;
+    }
+    literal.push_back(node.value);
+    return true;
+}
+
+// the alternatives of the whole pattern, just the one without a |
+std::span<Ast::NodeId const> alternatives(Ast const &ast) {
+    if (ast.node(ast.root()).kind == Ast::Kind::ALTERNATION) {
+        return ast.children(ast.root());
+    }
+    return {&ast.root(), 1};
+}
+
+// empty if the pattern is not made of plain literals
+std::vector<std::string> extract_literals(Ast const &ast) {
+    std::vector<std::string> literals;
+    for (auto alternative : alternatives(ast)) {
+        std::string literal;
+        // an empty alternative never produces a match, but it doesn't make
+        // the pattern a literal either
+        if (!append_literal(ast, alternative, literal) || literal.empty()) {
+            return {};
+        }
+        literals.push_back(std::move(literal));
+    }
+    return literals;
+}
+
+bool ends_in_eol(Ast const &ast, Ast::NodeId id) {
+    auto const &node = ast.node(id);
+    if (node.kind == Ast::Kind::EOL) {
+        return true;
+    }
+    auto children = ast.children(id);
+    return node.kind == Ast::Kind::CONCAT && !children.empty() &&
+           ends_in_eol(ast, children.back());
+}
+
+} // namespace
+
+// concatenation leaves behind states with no way out, they don't count
+// towards the nondeterminism of a state
+bool is_live(CompactTable const &table, CompactTable::StateId s) {
+    return table.is_accepting(s) || !table.all_transitions(s).empty();
+}
+
+size_t distinct_live_targets(CompactTable const &table,
+                             std::span<CompactTable::StateId const> targets) {
+    std::vector<CompactTable::StateId> ids;
+    for (auto s : targets) {
+        if (is_live(table, s)) {
+            ids.push_back(s);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    return (size_t)std::distance(ids.begin(),
+                                 std::unique(ids.begin(), ids.end()));
+}
+
+bool only_moves_on_bol(CompactTable const &table, CompactTable::StateId s) {
+    if (table.is_accepting(s)) {
+        return false;
+    }
+    // everything out of s goes through the bol column
+    auto on_bol = table.get_transition(s, BOL_SYMBOL);
+    return !on_bol.empty() &&
+           on_bol.size() == table.all_transitions(s).size();
+}
+
+PatternAnalysis analyze_ast(Ast const &ast, bool reverse, bool icase) {
+    PatternAnalysis analysis;
+    analysis.icase = icase;
+
+    analysis.literals = extract_literals(ast);
+    if (!analysis.literals.empty()) {
+        if (reverse) {
+            for (auto &literal : analysis.literals) {
+                std::reverse(literal.begin(), literal.end());
+            }
+        }
+        analysis.pure_literal = analysis.literals.size() == 1;
+        analysis.literal_alternation = analysis.literals.size() > 1;
+    }
+    // every alternative has to end in one. a reversed table starts from
+    // where the $ was
+    auto ends = alternatives(ast);
+    analysis.eol_anchored =
+        !reverse && std::all_of(ends.begin(), ends.end(),
+                                [&ast](Ast::NodeId id) {
+                                    return ends_in_eol(ast, id);
+                                });
+    analysis.engine = choose_engine(analysis);
+    return analysis;
+}
+
+bool needs_table(PatternAnalysis const &analysis) {
+    return !analysis.pure_literal && !analysis.literal_alternation;
+}
+
+void analyze_table(PatternAnalysis &analysis, CompactTable const &table) {
+    analysis.table_analyzed = true;
+    auto starting_states = table.starting_states();
+    analysis.bol_anchored =
+        !starting_states.empty() &&
+        std::all_of(starting_states.begin(), starting_states.end(),
+                    [&table](CompactTable::StateId s) {
+                        return only_moves_on_bol(table, s);
+                    });
+
+    analysis.word_boundaries = table.has_boundaries();
+    analysis.nfa_states = table.size();
+    analysis.byte_classes = table.class_count();
+    for (CompactTable::StateId s = 0; s < table.size(); ++s) {
+        bool nondeterministic = false;
+        for (size_t k = 0; k < table.class_count(); ++k) {
+            size_t fanout = distinct_live_targets(
+                table, table.get_class_transition(s, k));
+            analysis.max_fanout = std::max(analysis.max_fanout, fanout);
+            nondeterministic = nondeterministic || fanout > 1;
+        }
+        analysis.nondeterministic_states += nondeterministic;
+    }
+
+    analysis.small_nfa = analysis.nfa_states <= SMALL_NFA_STATES;
+    analysis.state_explosion_risk = analysis.nondeterministic_states >
+                                    EXPLOSION_NONDETERMINISTIC_STATES;
+    analysis.dfa_friendly = !analysis.state_explosion_risk;
+
+    analysis.engine = choose_engine(analysis);
+}
+
+Engine choose_engine(PatternAnalysis const &analysis) {
+    if (analysis.pure_literal) {
+        return Engine::LITERAL;
+    }
+    if (analysis.literal_alternation) {
+        return Engine::LITERAL_ALTERNATION;
+    }
+    if (analysis.bol_anchored) {
+        return Engine::ANCHORED_NFA;
+    }
+    if (analysis.table_analyzed && analysis.dfa_friendly) {
+        return Engine::LAZY_DFA;
+    }
+    return Engine::NFA_SIMULATION;
+}
+
+char const *engine_name(Engine engine) {
+    switch (engine) {
+    case Engine::NFA_SIMULATION:
+        return "nfa-simulation";
+    case Engine::ANCHORED_NFA:
+        return "anchored-nfa";
+    case Engine::LITERAL:
+        return "literal";
+    case Engine::LITERAL_ALTERNATION:
+        return "literal-alternation";
+    case Engine::LAZY_DFA:
+        return "lazy-dfa";
+    }
+    return "unknown";
+}
+
+std::string explain(PatternAnalysis const &analysis) {
+    auto yes_no = [](bool b) { return b ? "yes" : "no"; };
+
+    std::ostringstream os;
+    os << "engine: " << engine_name(analysis.engine) << std::endl;
+    switch (analysis.engine) {
+    case Engine::ANCHORED_NFA:
+        os << "reason: every match has to start at the beginning of a line"
+           << std::endl;
+        break;
+    case Engine::NFA_SIMULATION:
+        os << "reason: determinizing risks a state explosion" << std::endl;
+        break;
+    case Engine::LITERAL:
+        os << "reason: the pattern is a single literal" << std::endl;
+        break;
+    case Engine::LITERAL_ALTERNATION:
+        os << "reason: the pattern is an alternation of literals"
+           << std::endl;
+        break;
+    case Engine::LAZY_DFA:
+        os << "reason: the nfa determinizes without blowing up" << std::endl;
+        break;
+    }
+
+    os << "pure literal: " << yes_no(analysis.pure_literal) << std::endl;
+    os << "literal alternation: " << yes_no(analysis.literal_alternation);
+    if (analysis.literal_alternation) {
+        os << " (" << analysis.literals.size() << " literals)";
+    }
+    os << std::endl;
+    os << "case insensitive: " << yes_no(analysis.icase) << std::endl;
+    os << "bol anchored: " << yes_no(analysis.bol_anchored) << std::endl;
+    os << "eol anchored: " << yes_no(analysis.eol_anchored) << std::endl;
+    if (!analysis.table_analyzed) {
+        os << "nfa: not compiled" << std::endl;
+        return os.str();
+    }
+    os << "word boundaries: " << yes_no(analysis.word_boundaries)
+       << std::endl;
+    os << "nfa states: " << analysis.nfa_states << std::endl;
+    os << "byte classes: " << analysis.byte_classes << std::endl;
+    os << "nondeterministic states: " << analysis.nondeterministic_states
+       << std::endl;
+    os << "max fanout: " << analysis.max_fanout << std::endl;
+    os << "small nfa: " << yes_no(analysis.small_nfa) << std::endl;
+    os << "dfa friendly: " << yes_no(analysis.dfa_friendly) << std::endl;
+    os << "state explosion risk: " << yes_no(analysis.state_explosion_risk)
+       << std::endl;
+    return os.str();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "CompactTable.h"
+#include "ast.h"
+
+#include <stddef.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// the strategies a Matcher can run a compiled pattern with
+enum class Engine {
+    // one thread per starting offset, advanced over the nfa
+    NFA_SIMULATION,
+    // like NFA_SIMULATION, but only the line start ever spawns a thread
+    ANCHORED_NFA,
+    // a single literal, searched with memmem
+    LITERAL,
+    // several literals, searched with aho-corasick
+    LITERAL_ALTERNATION,
+    // one thread per starting offset, each a lazily determinized state
+    LAZY_DFA,
+};
+
+struct PatternAnalysis {
+    // the whole pattern is a single run of plain characters
+    bool pure_literal = false;
+    // top level alternation of plain character runs
+    bool literal_alternation = false;
+    // the literals for either of the two cases above
+    std::vector<std::string> literals;
+    // letters match either case, literals included
+    bool icase = false;
+
+    // every starting state can only move on BOL
+    bool bol_anchored = false;
+    // every alternative of the pattern ends in a $
+    bool eol_anchored = false;
+    // \b or \B somewhere in the table, the threads need the previous byte
+    bool word_boundaries = false;
+
+    // literal patterns never get compiled into a table
+    bool table_analyzed = false;
+    size_t nfa_states = 0;
+    // columns per row once identical chars are merged
+    size_t byte_classes = 0;
+    // states that go to more than one state on some char
+    size_t nondeterministic_states = 0;
+    // the most states a single (state, char) pair can fan out to
+    size_t max_fanout = 0;
+
+    bool small_nfa = false;
+    bool dfa_friendly = false;
+    bool state_explosion_risk = false;
+
+    Engine engine = Engine::NFA_SIMULATION;
+};
+
+// beyond this many states, simulating the nfa per thread starts to hurt
+inline constexpr size_t SMALL_NFA_STATES = 16;
+// beyond this many nondeterministic states the subset construction can blow
+// up, e.g. (a|b)*a(a|b)(a|b)(a|b)...
+inline constexpr size_t EXPLOSION_NONDETERMINISTIC_STATES = 8;
+
+// the facts the tree alone gives away, cheap enough to run before compiling
+PatternAnalysis analyze_ast(Ast const &ast, bool reverse, bool icase);
+
+// fills in the facts that need the compiled table
+void analyze_table(PatternAnalysis &analysis, CompactTable const &table);
+
+// whether the engine runs on the compiled table at all
+bool needs_table(PatternAnalysis const &analysis);
+
+Engine choose_engine(PatternAnalysis const &analysis);
+
+char const *engine_name(Engine engine);
+
+// human readable summary of why an engine got picked
+std::string explain(PatternAnalysis const &analysis);
+
+inline std::ostream &operator<<(std::ostream &os,
+                                PatternAnalysis const &analysis) {
+    os << explain(analysis);
+    return os;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <span>
+#include <vector>
+
+// a parsed pattern. the nodes live in one vector and refer to their
+// children by index into another, so a whole tree is a handful of
+// allocations, and walking it never chases pointers all over the heap.
+// every node remembers which part of the pattern it came from. nodes only
+// ever get added, a rewrite can leave some behind that nothing refers to
+// and share a subtree between parents
+class Ast {
+  public:
+    using NodeId = uint32_t;
+
+    enum class Kind : uint8_t {
+        // a single char, value is the char
+        CHAR,
+        // .
+        DOT,
+        // \d, \D, \s, \S, \w or \W, value is the letter
+        CLASS,
+        // [...], value is 1 if negated. the members are set items, not
+        // children
+        SET,
+        // (...), its only child is what's inside
+        GROUP,
+        // its only child with a *, + or ? after it, value is which
+        REPEAT,
+        // the children one after the other. none matches the empty string
+        CONCAT,
+        // any one of the children
+        ALTERNATION,
+        // ^, $, and \b or \B with the letter as value. a ^ anchors its
+        // whole sequence, whatever came before it in there included
+        BOL,
+        EOL,
+        BOUNDARY,
+    };
+
+    struct Node {
+        Kind kind;
+        char value = 0;
+        // [begin, end) of the pattern
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        // the children or the set items, whichever the kind has
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    // a member of a set: a range of chars, a single char being a range of
+    // one, or the letter of \d and friends
+    struct SetItem {
+        char first = 0;
+        char last = 0;
+        // 0 unless it's a reserved set
+        char reserved = 0;
+
+        bool operator==(SetItem const &) const = default;
+    };
+
+  private:
+    std::vector<Node> nodes;
+    std::vector<NodeId> child_ids;
+    std::vector<SetItem> items;
+    NodeId root_id = 0;
+
+    NodeId add(Node node) {
+        nodes.push_back(node);
+        return (NodeId)(nodes.size() - 1);
+    }
+
+  public:
+    NodeId add_leaf(Kind kind, char value, size_t begin, size_t end) {
+        return add({kind, value, (uint32_t)begin, (uint32_t)end, 0, 0});
+    }
+
+    NodeId add_parent(Kind kind, char value, std::span<NodeId const> children,
+                      size_t begin, size_t end) {
+        auto first = (uint32_t)child_ids.size();
+        child_ids.insert(child_ids.end(), children.begin(), children.end());
+        return add({kind, value, (uint32_t)begin, (uint32_t)end, first,
+                    (uint32_t)children.size()});
+    }
+
+    NodeId add_set(bool negated, std::span<SetItem const> members,
+                   size_t begin, size_t end) {
+        auto first = (uint32_t)items.size();
+        items.insert(items.end(), members.begin(), members.end());
+        return add({Kind::SET, (char)negated, (uint32_t)begin, (uint32_t)end,
+                    first, (uint32_t)members.size()});
+    }
+
+    // copies the tree under id in other over, and returns where it went.
+    // the spans still refer to the pattern other was parsed from
+    NodeId add_tree(Ast const &other, NodeId id) {
+        Node const &n = other.node(id);
+        if (n.kind == Kind::SET) {
+            return add_set(n.value != 0, other.set_items(id), n.begin, n.end);
+        }
+        std::vector<NodeId> copied;
+        for (auto child : other.children(id)) {
+            copied.push_back(add_tree(other, child));
+        }
+        return add_parent(n.kind, n.value, copied, n.begin, n.end);
+    }
+
+    void set_root(NodeId id) {
+        root_id = id;
+    }
+
+    // a reference, so the root alone can be handed out as a span
+    NodeId const &root() const {
+        return root_id;
+    }
+
+    Node const &node(NodeId id) const {
+        return nodes[id];
+    }
+
+    std::span<NodeId const> children(NodeId id) const {
+        Node const &n = nodes[id];
+        if (n.kind == Kind::SET) {
+            return {};
+        }
+        return {child_ids.data() + n.first, n.count};
+    }
+
+    std::span<SetItem const> set_items(NodeId id) const {
+        Node const &n = nodes[id];
+        if (n.kind != Kind::SET) {
+            return {};
+        }
+        return {items.data() + n.first, n.count};
+    }
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    // assertions match no char, they only restrict where the rest can
+    static bool is_assertion(Kind kind) {
+        return kind == Kind::BOL || kind == Kind::EOL ||
+               kind == Kind::BOUNDARY;
+    }
+};
+
+// a lisp-like dump of the tree, for debugging
+inline void print_node(std::ostream &os, Ast const &ast, Ast::NodeId id) {
+    using enum Ast::Kind;
+    auto const &n = ast.node(id);
+    switch (n.kind) {
+    case CHAR:
+        os << "'" << n.value << "'";
+        return;
+    case DOT:
+        os << "dot";
+        return;
+    case CLASS:
+        os << "\\" << n.value;
+        return;
+    case SET:
+        os << (n.value ? "[^" : "[");
+        for (auto const &item : ast.set_items(id)) {
+            if (item.reserved != 0) {
+                os << "\\" << item.reserved;
+            } else if (item.first == item.last) {
+                os << item.first;
+            } else {
+                os << item.first << "-" << item.last;
+            }
+        }
+        os << "]";
+        return;
+    case BOL:
+        os << "bol";
+        return;
+    case EOL:
+        os << "eol";
+        return;
+    case BOUNDARY:
+        os << "\\" << n.value;
+        return;
+    case GROUP:
+        os << "(group";
+        break;
+    case REPEAT:
+        os << "(" << n.value;
+        break;
+    case CONCAT:
+        os << "(concat";
+        break;
+    case ALTERNATION:
+        os << "(or";
+        break;
+    }
+    for (auto child : ast.children(id)) {
+        os << " ";
+        print_node(os, ast, child);
+    }
+    os << ")";
+}
+
+inline std::ostream &operator<<(std::ostream &os, Ast const &ast) {
+    if (ast.size() > 0) {
+        print_node(os, ast, ast.root());
+    }
+    return os;
+}
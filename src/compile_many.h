@@ -0,0 +1,133 @@
+#pragma once
+
+#include "ast.h"
+#include "compiled_regex.h"
+#include "parser.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+struct CompileManyOptions {
+    // every pattern gets compiled with these
+    CompileOptions compile = {};
+    // 0 means one per core
+    size_t threads = 0;
+    // compile every pattern into a regex of its own. without it the
+    // patterns only get parsed, to check them and to combine them
+    bool per_pattern = true;
+    // also compile everything that parsed into one regex, which matches
+    // wherever any of them does. scanning for that once costs a lot less
+    // than scanning for each of them, but the matches don't say whose
+    // they are
+    bool combined = false;
+};
+
+// how one pattern went
+struct CompiledPattern {
+    // unset if it failed, or if it only got parsed
+    CompiledRegexPtr regex;
+    // why it failed, empty if it didn't
+    std::string error;
+
+    bool ok() const {
+        return error.empty();
+    }
+};
+
+struct CompiledSet {
+    // one for every pattern, in the same order
+    std::vector<CompiledPattern> patterns;
+    // with CompileManyOptions::combined, unless none of them parsed
+    CompiledRegexPtr combined;
+
+    size_t failed() const {
+        return (size_t)std::count_if(
+            patterns.begin(), patterns.end(),
+            [](CompiledPattern const &pattern) { return !pattern.ok(); });
+    }
+};
+
+// compiles a whole set of patterns, a rule pack say, on a pool of threads.
+// every thread takes the next pattern nobody has started on, so a few
+// expensive patterns don't hold up the rest. a pattern that fails only
+// fails itself: its error goes into its CompiledPattern and the others
+// carry on. the combined regex is built from the trees parsed on the way,
+// but only once the pool is done, and it's one compilation on the calling
+// thread alone. for a big set that single compile can take about as long
+// as all the others together. it throws what compile_regex() would
+// (LimitError past max_states, for one)
+inline CompiledSet compile_many(std::span<std::string_view const> patterns,
+                                CompileManyOptions const &options = {}) {
+    CompiledSet result;
+    result.patterns.resize(patterns.size());
+    std::vector<std::optional<Ast>> asts(patterns.size());
+
+    std::atomic<size_t> next_pattern = 0;
+    auto work = [&] {
+        for (size_t idx = next_pattern.fetch_add(1); idx < patterns.size();
+             idx = next_pattern.fetch_add(1)) {
+            auto &compiled = result.patterns[idx];
+            try {
+                Ast ast = parse(patterns[idx]);
+                if (options.per_pattern) {
+                    compiled.regex = std::make_shared<CompiledRegex const>(
+                        ast, options.compile);
+                }
+                // only what compiled goes into the combined regex
+                if (options.combined) {
+                    asts[idx] = std::move(ast);
+                }
+            } catch (std::exception const &e) {
+                compiled.error = e.what();
+            }
+        }
+    };
+
+    size_t threads = options.threads;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // the calling thread is one of them
+    std::vector<std::thread> workers;
+    try {
+        for (size_t idx = 1; idx < std::min(threads, patterns.size());
+             ++idx) {
+            workers.emplace_back(work);
+        }
+    } catch (std::system_error const &) {
+        // out of threads. the ones that started and this one take whatever
+        // is left, down to this one alone
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    if (options.combined) {
+        Ast combined;
+        std::vector<Ast::NodeId> alternatives;
+        for (auto const &ast : asts) {
+            if (ast) {
+                alternatives.push_back(combined.add_tree(*ast, ast->root()));
+            }
+        }
+        if (!alternatives.empty()) {
+            combined.set_root(combined.add_parent(Ast::Kind::ALTERNATION, 0,
+                                                  alternatives, 0, 0));
+            result.combined = std::make_shared<CompiledRegex const>(
+                std::move(combined), options.compile);
+        }
+    }
+    return result;
+}
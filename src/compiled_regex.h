@@ -0,0 +1,122 @@
+#pragma once
+
+#include "CompactTable.h"
+#include "analyzer.h"
+#include "literal.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "stats.h"
+#include "table_profile.h"
+
+#include <stdint.h>
+
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+struct CompileOptions {
+    // build the table for running over the input backwards
+    bool reverse = false;
+    // ascii letters match either case. folded into the table, so scanning
+    // costs the same and the input never gets copied
+    bool icase = false;
+    // compiling throws LimitError past this many nfa states. patterns
+    // served by the literal searchers never build a table and never hit it
+    size_t max_states = NO_LIMIT;
+    // rewrite the pattern into fewer states first, see optimizer.h. only
+    // worth turning off to see what it changed
+    bool optimize = true;
+    // input like what will get scanned. if given, the states it visits
+    // most get laid out next to each other, see table_profile.h. it's only
+    // read while compiling
+    std::span<std::string_view const> layout_sample = {};
+};
+
+// everything compiling a pattern produces. it never changes after
+// construction, so one instance can be shared by any number of threads
+// without copies or locks. the state that does change while scanning (the
+// threads, the dfa cache) lives in a Scanner, one per thread
+class CompiledRegex {
+    CompactTable table;
+    PatternAnalysis analysis;
+    LiteralSearcher literal_searcher;
+    // all zeroes unless built with REGEX_STATS
+    uint64_t compile_ns = 0;
+
+    void build(Ast ast, CompileOptions const &options) {
+        analysis = analyze_ast(ast, options.reverse, options.icase);
+        if (!needs_table(analysis)) {
+            // literals never touch the automaton
+            literal_searcher =
+                LiteralSearcher(analysis.literals, options.icase);
+            return;
+        }
+        if (options.optimize) {
+            ast = ::optimize(ast);
+        }
+        table = compile(ast, options.reverse, options.icase,
+                        options.max_states);
+        if (!options.layout_sample.empty()) {
+            table.place_hot_states_first(
+                count_state_visits(table, options.layout_sample));
+        }
+        analyze_table(analysis, table);
+    }
+
+  public:
+    explicit CompiledRegex(std::string_view pattern,
+                           CompileOptions options = {}) {
+        StatsTimer compile_timer(compile_ns);
+        // throws ParseError, with where the pattern went wrong
+        build(parse(pattern), options);
+    }
+
+    // the same for a pattern that's parsed already, or put together out
+    // of others like compile_many() does it
+    CompiledRegex(Ast ast, CompileOptions options) {
+        StatsTimer compile_timer(compile_ns);
+        build(std::move(ast), options);
+    }
+
+    CompiledRegex(CompiledRegex const &) = delete;
+    CompiledRegex &operator=(CompiledRegex const &) = delete;
+
+    Engine engine() const {
+        return analysis.engine;
+    }
+
+    CompactTable const &get_table() const {
+        return table;
+    }
+
+    PatternAnalysis const &get_analysis() const {
+        return analysis;
+    }
+
+    LiteralSearcher const &get_literal_searcher() const {
+        return literal_searcher;
+    }
+
+    uint64_t get_compile_ns() const {
+        return compile_ns;
+    }
+
+    // what the analyzer saw in the pattern and which engine it picked
+    std::string explain() const {
+        return ::explain(analysis);
+    }
+};
+
+using CompiledRegexPtr = std::shared_ptr<CompiledRegex const>;
+
+inline CompiledRegexPtr compile_regex(std::string_view pattern,
+                                      CompileOptions options = {}) {
+    return std::make_shared<CompiledRegex const>(pattern, options);
+}
+
+inline std::ostream &operator<<(std::ostream &os, CompiledRegex const &regex) {
+    os << regex.get_table() << std::endl;
+    return os;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#ifndef REGEX_ZSTD
+#define REGEX_ZSTD 0
+#endif
+
+#if REGEX_ZSTD
+#include <zstd.h>
+#endif
+
+// undoes the gzip or zstd compression of what gets read from an fd, a
+// buffer at a time, for a ReadPipeline to run on its reader thread. which
+// one is told by the magic bytes, and anything that starts with neither
+// comes out as it is, so -z works on a mix of compressed and plain inputs.
+// concatenated gzip members and zstd frames come out one after the other,
+// like gzip -d does it. zstd needs the build to find libzstd
+class Decompressor {
+  public:
+    enum class Format { PLAIN, GZIP, ZSTD };
+
+    static constexpr size_t INPUT_SIZE = 128 << 10;
+
+  private:
+    int fd;
+    std::string label;
+    std::unique_ptr<char[]> input{new char[INPUT_SIZE]};
+    size_t input_pos = 0;
+    size_t input_size = 0;
+    bool input_done = false;
+
+    bool started = false;
+    Format format = Format::PLAIN;
+    // in the middle of a gzip member or a zstd frame, the input can't end
+    bool in_frame = false;
+
+    z_stream gzip;
+    bool gzip_open = false;
+#if REGEX_ZSTD
+    ZSTD_DStream *zstd = nullptr;
+#endif
+
+    [[noreturn]] void fail(std::string const &what) const {
+        throw std::runtime_error(label + ": " + what);
+    }
+
+    // reads more input once all of it got used, false at the end
+    bool refill() {
+        if (input_pos < input_size) {
+            return true;
+        }
+        input_pos = 0;
+        input_size = 0;
+        while (!input_done) {
+            ssize_t got = ::read(fd, input.get(), INPUT_SIZE);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                fail(strerror(errno));
+            }
+            input_size = (size_t)got;
+            input_done = got == 0;
+            break;
+        }
+        return input_size > 0;
+    }
+
+    // the magic bytes can come in over more than one read from a pipe
+    Format detect() {
+        while (!input_done && input_size < 4) {
+            ssize_t got = ::read(fd, input.get() + input_size,
+                                 INPUT_SIZE - input_size);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                fail(strerror(errno));
+            }
+            input_size += (size_t)got;
+            input_done = got == 0;
+        }
+        auto const *head = reinterpret_cast<unsigned char const *>(input.get());
+        if (input_size >= 2 && head[0] == 0x1f && head[1] == 0x8b) {
+            return Format::GZIP;
+        }
+        if (input_size >= 4 && head[0] == 0x28 && head[1] == 0xb5 &&
+            head[2] == 0x2f && head[3] == 0xfd) {
+            return Format::ZSTD;
+        }
+        return Format::PLAIN;
+    }
+
+    void start() {
+        started = true;
+        format = detect();
+        if (format == Format::GZIP) {
+            memset(&gzip, 0, sizeof(gzip));
+            // 16 means a gzip header and trailer
+            if (inflateInit2(&gzip, 16 + MAX_WBITS) != Z_OK) {
+                fail("can't set up zlib");
+            }
+            gzip_open = true;
+        } else if (format == Format::ZSTD) {
+#if REGEX_ZSTD
+            zstd = ZSTD_createDStream();
+            if (zstd == nullptr) {
+                fail("can't set up zstd");
+            }
+#else
+            fail("zstd compressed, but built without libzstd");
+#endif
+        }
+    }
+
+    size_t inflate_into(char *out, size_t size) {
+        gzip.next_in = reinterpret_cast<Bytef *>(input.get() + input_pos);
+        gzip.avail_in = (uInt)(input_size - input_pos);
+        gzip.next_out = reinterpret_cast<Bytef *>(out);
+        gzip.avail_out = (uInt)std::min<size_t>(size, UINT32_MAX);
+        int status = inflate(&gzip, Z_NO_FLUSH);
+        size_t used = input_size - input_pos - gzip.avail_in;
+        size_t written = size_t(reinterpret_cast<char *>(gzip.next_out) - out);
+        input_pos += used;
+        in_frame = true;
+        if (status == Z_STREAM_END) {
+            // whatever follows is the next member
+            inflateReset(&gzip);
+            in_frame = false;
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            fail(gzip.msg != nullptr ? gzip.msg : "corrupt gzip data");
+        }
+        return written;
+    }
+
+#if REGEX_ZSTD
+    size_t decompress_into(char *out, size_t size) {
+        ZSTD_inBuffer in{input.get(), input_size, input_pos};
+        ZSTD_outBuffer to{out, size, 0};
+        size_t status = ZSTD_decompressStream(zstd, &to, &in);
+        if (ZSTD_isError(status)) {
+            fail(ZSTD_getErrorName(status));
+        }
+        input_pos = in.pos;
+        // 0 means a frame just ended
+        in_frame = status != 0;
+        return to.pos;
+    }
+#endif
+
+  public:
+    // fd stays open and has to outlive this
+    Decompressor(int init_fd, std::string init_label)
+        : fd(init_fd), label(std::move(init_label)) {
+    }
+
+    Decompressor(Decompressor const &) = delete;
+    Decompressor &operator=(Decompressor const &) = delete;
+
+    ~Decompressor() {
+        if (gzip_open) {
+            inflateEnd(&gzip);
+        }
+#if REGEX_ZSTD
+        ZSTD_freeDStream(zstd);
+#endif
+    }
+
+    // writes up to size decompressed bytes to out and returns how many, 0
+    // once the input is over. throws std::runtime_error on read errors and
+    // on corrupt or cut off input
+    size_t read(char *out, size_t size) {
+        if (!started) {
+            start();
+        }
+        size_t written = 0;
+        while (written == 0 && size > 0) {
+            if (!refill()) {
+                if (in_frame) {
+                    fail("compressed data cut off");
+                }
+                return 0;
+            }
+            switch (format) {
+            case Format::PLAIN:
+                written = std::min(size, input_size - input_pos);
+                memcpy(out, input.get() + input_pos, written);
+                input_pos += written;
+                break;
+            case Format::GZIP:
+                written = inflate_into(out, size);
+                break;
+            case Format::ZSTD:
+#if REGEX_ZSTD
+                written = decompress_into(out, size);
+#endif
+                break;
+            }
+        }
+        return written;
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "CompactTable.h"
+#include "TransitionTable.h"
+#include "compiled_regex.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <vector>
+
+// where a pattern can match the empty string. the scanner never reports
+// empty matches, but a line grep would print because of one, like every
+// line for ^ or z*, has to get printed all the same. whether an empty
+// match fits only depends on the assertions that hold where it would be,
+// so that's worked out once for every combination of them
+class EmptyMatches {
+    // indexed by context()
+    std::array<bool, 16> possible{};
+
+    static size_t context(bool bol, bool eol, bool prev_word, bool next_word) {
+        return size_t(bol) | size_t(eol) << 1 | size_t(prev_word) << 2 |
+               size_t(next_word) << 3;
+    }
+
+    // every assertion that holds at a position can be taken, in any order
+    // and any number of times, without moving
+    static bool accepts_without_input(CompactTable const &table, bool bol,
+                                      bool eol, bool prev_word,
+                                      bool next_word) {
+        std::vector<CompactTable::StateId> states;
+        for (auto s : table.starting_states()) {
+            if (!table.is_dead(s)) {
+                states.push_back(s);
+            }
+        }
+        bool grew = true;
+        while (grew) {
+            grew = false;
+            if (bol) {
+                grew |= table.close_over(BOL_SYMBOL, states);
+            }
+            if (eol) {
+                grew |= table.close_over(EOL_SYMBOL, states);
+            }
+            if (table.has_boundaries()) {
+                grew |= table.close_over(
+                    boundary_symbol(prev_word, next_word), states);
+            }
+        }
+        return std::any_of(states.begin(), states.end(),
+                           [&table](CompactTable::StateId s) {
+                               return table.is_accepting(s);
+                           });
+    }
+
+  public:
+    explicit EmptyMatches(CompiledRegex const &regex) {
+        if (!needs_table(regex.get_analysis())) {
+            // only the empty literal matches the empty string
+            auto const &literals = regex.get_analysis().literals;
+            bool empty_literal =
+                std::any_of(literals.begin(), literals.end(),
+                            [](std::string const &s) { return s.empty(); });
+            possible.fill(empty_literal);
+            return;
+        }
+        for (size_t idx = 0; idx < possible.size(); ++idx) {
+            possible[idx] = accepts_without_input(
+                regex.get_table(), idx & 1, idx & 2, idx & 4, idx & 8);
+        }
+    }
+
+    // whether some line could get picked for an empty match alone
+    bool any() const {
+        return std::find(possible.begin(), possible.end(), true) !=
+               possible.end();
+    }
+
+    // whether the pattern matches the empty string somewhere in line,
+    // which comes without its newline
+    bool fits(std::string_view line) const {
+        size_t size = line.size();
+        bool first_word = size > 0 && is_word_char(line.front());
+        bool last_word = size > 0 && is_word_char(line.back());
+        if (possible[context(true, size == 0, false, first_word)] ||
+            (size > 0 && possible[context(false, true, last_word, false)])) {
+            return true;
+        }
+        bool inside = false;
+        for (size_t idx = 0; idx < 4; ++idx) {
+            inside |= possible[idx << 2];
+        }
+        if (!inside) {
+            return false;
+        }
+        for (size_t idx = 1; idx < size; ++idx) {
+            if (possible[context(false, false, is_word_char(line[idx - 1]),
+                                 is_word_char(line[idx]))]) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
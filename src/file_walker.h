@@ -0,0 +1,232 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// one file or directory to visit
+struct WalkItem {
+    std::filesystem::path path;
+    // orders the output: the index of the path on the command line, then
+    // the index of every directory entry (sorted by name) on the way down
+    std::vector<uint32_t> key;
+    bool top_level = false;
+};
+
+struct WalkOptions {
+    // descend into directories, otherwise they are reported as errors
+    bool recursive = false;
+    size_t threads = 1;
+};
+
+// visits every file under a set of roots on a pool of threads. every
+// worker owns a queue: it pushes the entries of the directories it lists
+// onto the back and pops from the back, so it walks depth first and keeps
+// its working set small. a worker that runs dry steals from the front of
+// somebody else's queue, which is where the biggest untouched subtrees are
+class FileWalker {
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<WalkItem> items;
+    };
+
+    WalkOptions options;
+    std::vector<WorkQueue> queues;
+    // items pushed but not done yet. the walk is over once this hits 0
+    std::atomic<size_t> pending = 0;
+    // items in the queues that nobody took yet
+    std::atomic<size_t> queued = 0;
+    // a worker with nothing to do sleeps on this until something gets
+    // pushed or the walk is over
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    // the keys of the items pending, the lowest of them is how far the walk
+    // got in key order
+    std::mutex order_lock;
+    std::set<std::vector<uint32_t>> unfinished;
+
+    void wake(bool everyone) {
+        // a sleeper checks under the lock, so with it held here its check
+        // either saw the change already or it's waiting for this
+        std::lock_guard guard(idle_lock);
+        if (everyone) {
+            idle.notify_all();
+        } else {
+            idle.notify_one();
+        }
+    }
+
+    void push(size_t worker_idx, WalkItem item) {
+        pending.fetch_add(1);
+        {
+            std::lock_guard guard(order_lock);
+            unfinished.insert(item.key);
+        }
+        {
+            std::lock_guard guard(queues[worker_idx].lock);
+            queues[worker_idx].items.push_back(std::move(item));
+        }
+        queued.fetch_add(1);
+        wake(false);
+    }
+
+    std::optional<WalkItem> pop(size_t worker_idx) {
+        {
+            auto &own = queues[worker_idx];
+            std::lock_guard guard(own.lock);
+            if (!own.items.empty()) {
+                WalkItem item = std::move(own.items.back());
+                own.items.pop_back();
+                queued.fetch_sub(1);
+                return item;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            auto &victim = queues[(worker_idx + offset) % queues.size()];
+            std::lock_guard guard(victim.lock);
+            if (!victim.items.empty()) {
+                WalkItem item = std::move(victim.items.front());
+                victim.items.pop_front();
+                queued.fetch_sub(1);
+                return item;
+            }
+        }
+        return {};
+    }
+
+    template <typename OnError>
+    void expand(size_t worker_idx, WalkItem const &dir, OnError &on_error) {
+        std::error_code ec;
+        std::vector<std::filesystem::path> entries;
+        for (std::filesystem::directory_iterator it(dir.path, ec), end;
+             !ec && it != end; it.increment(ec)) {
+            entries.push_back(it->path());
+        }
+        if (ec) {
+            on_error(worker_idx, dir.path.string() + ": " + ec.message());
+            return;
+        }
+        std::sort(entries.begin(), entries.end());
+
+        // in reverse, so the first entry is the next one popped
+        for (size_t idx = entries.size(); idx-- > 0;) {
+            WalkItem child{std::move(entries[idx]), dir.key, false};
+            child.key.push_back((uint32_t)idx);
+            push(worker_idx, std::move(child));
+        }
+    }
+
+    template <typename Visit, typename OnError>
+    void process(size_t worker_idx, WalkItem const &item, Visit &visit,
+                 OnError &on_error) {
+        std::error_code ec;
+        // the command line follows symlinks, the walk itself doesn't
+        auto status = item.top_level ? std::filesystem::status(item.path, ec)
+                                     : std::filesystem::symlink_status(
+                                           item.path, ec);
+        if (ec) {
+            on_error(worker_idx, item.path.string() + ": " + ec.message());
+            return;
+        }
+
+        if (std::filesystem::is_directory(status)) {
+            if (!options.recursive) {
+                on_error(worker_idx, item.path.string() + ": Is a directory");
+                return;
+            }
+            expand(worker_idx, item, on_error);
+            return;
+        }
+        // sockets, devices and the like only get read when asked for by name
+        if (item.top_level || std::filesystem::is_regular_file(status)) {
+            visit(worker_idx, item);
+        }
+    }
+
+    // the lowest key still pending once item is done, none at the end
+    std::optional<std::vector<uint32_t>> finish(WalkItem const &item) {
+        std::lock_guard guard(order_lock);
+        unfinished.erase(item.key);
+        if (unfinished.empty()) {
+            return {};
+        }
+        return *unfinished.begin();
+    }
+
+    template <typename Visit, typename OnError, typename OnDone>
+    void work(size_t worker_idx, Visit &visit, OnError &on_error,
+              OnDone &on_done) {
+        while (true) {
+            auto item = pop(worker_idx);
+            if (!item) {
+                // someone is still listing a directory, or nothing is left
+                std::unique_lock guard(idle_lock);
+                idle.wait(guard, [this] {
+                    return queued.load() > 0 || pending.load() == 0;
+                });
+                if (pending.load() == 0) {
+                    return;
+                }
+                continue;
+            }
+            process(worker_idx, *item, visit, on_error);
+            auto first_unfinished = finish(*item);
+            on_done(worker_idx, first_unfinished ? &*first_unfinished
+                                                 : nullptr);
+            if (pending.fetch_sub(1) == 1) {
+                wake(true);
+            }
+        }
+    }
+
+  public:
+    explicit FileWalker(WalkOptions init_options)
+        : options(init_options),
+          queues(std::max<size_t>(init_options.threads, 1)) {
+    }
+
+    size_t thread_count() const {
+        return queues.size();
+    }
+
+    // calls visit(worker_idx, item) for every file and
+    // on_error(worker_idx, message) for everything that couldn't be walked.
+    // after every item on_done(worker_idx, first_unfinished) gets the
+    // lowest key of the items not done yet, nullptr if there are none. any
+    // item found later has a higher key than that, so whatever came out
+    // below it is final. all of them get called from all the workers at
+    // once, worker_idx says which
+    template <typename Visit, typename OnError, typename OnDone>
+    void run(std::vector<std::string> const &roots, Visit &&visit,
+             OnError &&on_error, OnDone &&on_done) {
+        for (size_t idx = 0; idx < roots.size(); ++idx) {
+            push(idx % queues.size(),
+                 {roots[idx], {(uint32_t)idx}, /*top_level=*/true});
+        }
+
+        std::vector<std::thread> workers;
+        for (size_t worker_idx = 1; worker_idx < queues.size();
+             ++worker_idx) {
+            workers.emplace_back(
+                [this, worker_idx, &visit, &on_error, &on_done] {
+                    work(worker_idx, visit, on_error, on_done);
+                });
+        }
+        work(0, visit, on_error, on_done);
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+};
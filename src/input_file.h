@@ -0,0 +1,120 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// an input to search, either read whole into a buffer the caller keeps
+// around, so reading many small files allocates nothing once the buffer
+// has grown, or left to be streamed through a ReadPipeline. big regular
+// files get streamed so reading ahead overlaps the scan, and so do pipes,
+// devices and stdin, which can be any size at all
+class InputFile {
+  public:
+    // below this, one read() into a warm buffer beats the pipeline
+    static constexpr size_t STREAM_THRESHOLD = 256 << 10;
+
+  private:
+    int fd = -1;
+    bool owns_fd = false;
+    bool stream = false;
+    std::string_view data;
+
+    [[noreturn]] static void fail(std::string const &label) {
+        throw std::runtime_error(label + ": " + strerror(errno));
+    }
+
+    void load(std::string const &label, std::string &buffer,
+              bool always_stream) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            fail(label);
+        }
+        if (S_ISDIR(st.st_mode)) {
+            errno = EISDIR;
+            fail(label);
+        }
+
+        size_t file_size = (size_t)st.st_size;
+        if (always_stream || !S_ISREG(st.st_mode) ||
+            file_size >= STREAM_THRESHOLD) {
+            stream = true;
+            return;
+        }
+
+        buffer.clear();
+        size_t chunk = file_size + 1;
+        while (true) {
+            size_t old_size = buffer.size();
+            buffer.resize(old_size + chunk);
+            ssize_t got = read(fd, buffer.data() + old_size, chunk);
+            if (got < 0) {
+                if (errno == EINTR) {
+                    buffer.resize(old_size);
+                    continue;
+                }
+                fail(label);
+            }
+            buffer.resize(old_size + (size_t)got);
+            if (got == 0) {
+                break;
+            }
+            chunk = 64 << 10;
+        }
+        data = buffer;
+    }
+
+  public:
+    // opens path and reads it unless it gets streamed, which always_stream
+    // asks for whatever the size. throws std::runtime_error on failure
+    InputFile(std::string const &path, std::string &buffer,
+              bool always_stream = false)
+        : fd(open(path.c_str(), O_RDONLY | O_CLOEXEC)), owns_fd(true) {
+        if (fd < 0) {
+            fail(path);
+        }
+        try {
+            load(path, buffer, always_stream);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    // the same for an already open fd, e.g. stdin, and leaves it open
+    InputFile(int init_fd, std::string const &label, std::string &buffer,
+              bool always_stream = false)
+        : fd(init_fd) {
+        load(label, buffer, always_stream);
+    }
+
+    InputFile(InputFile const &) = delete;
+    InputFile &operator=(InputFile const &) = delete;
+
+    ~InputFile() {
+        if (owns_fd) {
+            close(fd);
+        }
+    }
+
+    // all of it, unless streamed()
+    std::string_view contents() const {
+        return data;
+    }
+
+    // whether it's left to read through a ReadPipeline over descriptor()
+    bool streamed() const {
+        return stream;
+    }
+
+    int descriptor() const {
+        return fd;
+    }
+};
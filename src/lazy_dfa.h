@@ -0,0 +1,301 @@
+#pragma once
+
+#include "CompactTable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+struct DFACacheConfig {
+    // rough cap on the memory the determinized states can use
+    size_t memory_budget = 4 << 20;
+    // a clear that comes after fewer cache hits than this counts as thrashing
+    size_t min_hits_between_clears = 64 * 1024;
+    // how many thrashing clears in a row before giving up on the dfa
+    size_t max_thrashing_clears = 3;
+};
+
+struct DFACacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t clears = 0;
+    // what the cache is holding right now, and the most it ever held
+    size_t bytes = 0;
+    size_t peak_bytes = 0;
+    // how many times the matcher had to go back to the nfa
+    size_t fallbacks = 0;
+};
+
+// determinizes the nfa one (state set, char) pair at a time, as the input
+// asks for it. the cache is bounded: once it grows past the budget the owner
+// is expected to call reset_cache() between two steps.
+// with \b or \B in the pattern a dfa state also remembers whether the byte
+// before it was a word char, so the assertions get taken as part of the
+// transition on the next byte and cost nothing extra once cached
+class LazyDFA {
+  public:
+    static constexpr uint32_t DEAD = 0;
+    // set on a transition when the state matched right before the byte,
+    // after taking the assertions that hold there
+    static constexpr uint32_t MATCHED_BEFORE = 1u << 31;
+
+  private:
+    static constexpr uint32_t UNKNOWN = std::numeric_limits<uint32_t>::max();
+    // appended to the map keys of states that follow a word char
+    static constexpr CompactTable::StateId AFTER_WORD =
+        std::numeric_limits<CompactTable::StateId>::max();
+
+    using StateSet = std::vector<CompactTable::StateId>;
+
+    struct SetHash {
+        size_t operator()(StateSet const &set) const {
+            size_t seed = set.size();
+            for (auto idx : set) {
+                seed ^= std::hash<CompactTable::StateId>()(idx) + 0x9e3779b9 +
+                        (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        }
+    };
+
+    DFACacheConfig config;
+    DFACacheStats stats;
+
+    // dfa state -> sorted nfa state indices
+    std::vector<StateSet> state_sets;
+    std::unordered_map<StateSet, uint32_t, SetHash> state_ids;
+    // one entry per byte class per dfa state, UNKNOWN until first asked for
+    std::vector<uint32_t> transitions;
+    size_t row_width = 0;
+    std::vector<bool> accepting;
+    // whether the byte before the state was a word char, only ever set
+    // when the table has boundaries
+    std::vector<bool> after_word;
+    bool boundaries = false;
+    uint32_t start_id = DEAD;
+    uint32_t start_after_word_id = DEAD;
+
+    // scratch space for computing the next set
+    StateSet next_set;
+    StateSet key;
+
+    size_t hits_at_last_clear = 0;
+    size_t thrashing_clears = 0;
+
+    size_t state_bytes(size_t set_size) const {
+        // the row, the set stored twice (list and map key) and the map node
+        return row_width * sizeof(uint32_t) +
+               2 * set_size * sizeof(CompactTable::StateId) +
+               4 * sizeof(void *) + sizeof(StateSet);
+    }
+
+    uint32_t intern(CompactTable const &table, StateSet set,
+                    bool prev_word = false) {
+        key = set;
+        if (prev_word) {
+            key.push_back(AFTER_WORD);
+        }
+        if (auto it = state_ids.find(key); it != state_ids.end()) {
+            return it->second;
+        }
+
+        uint32_t new_id = (uint32_t)state_sets.size();
+        bool is_accepting =
+            std::any_of(set.begin(), set.end(), [&table](auto idx) {
+                return table.is_accepting(idx);
+            });
+
+        stats.bytes += state_bytes(set.size());
+        stats.peak_bytes = std::max(stats.peak_bytes, stats.bytes);
+
+        transitions.resize(transitions.size() + row_width, UNKNOWN);
+        accepting.push_back(is_accepting);
+        after_word.push_back(prev_word);
+        state_ids.insert({key, new_id});
+        state_sets.push_back(std::move(set));
+        return new_id;
+    }
+
+    void rebuild_base(CompactTable const &table) {
+        state_sets.clear();
+        state_ids.clear();
+        transitions.clear();
+        accepting.clear();
+        after_word.clear();
+        stats.bytes = 0;
+
+        // the empty set is always the dead state
+        intern(table, {});
+        auto starting_states = table.starting_states();
+        StateSet starting_set(starting_states.begin(), starting_states.end());
+        std::sort(starting_set.begin(), starting_set.end());
+        starting_set.erase(
+            std::unique(starting_set.begin(), starting_set.end()),
+            starting_set.end());
+        start_after_word_id = intern(table, starting_set, boundaries);
+        start_id = intern(table, std::move(starting_set));
+    }
+
+    // the set of dfa_state after taking the assertions that hold between
+    // its byte and one with next_word, in next_set. returns whether that
+    // made it match
+    bool close_boundaries(CompactTable const &table, uint32_t dfa_state,
+                          bool next_word) {
+        next_set = state_sets[dfa_state];
+        char symbol = boundary_symbol(after_word[dfa_state], next_word);
+        if (!table.close_over(symbol, next_set) || accepting[dfa_state]) {
+            return false;
+        }
+        return std::any_of(next_set.begin(), next_set.end(),
+                           [&table](auto idx) {
+                               return table.is_accepting(idx);
+                           });
+    }
+
+    // the set reached from the states in next_set on byte_class
+    void step_next_set(CompactTable const &table, size_t byte_class) {
+        StateSet from;
+        from.swap(next_set);
+        for (auto idx : from) {
+            auto targets = table.get_class_transition(idx, byte_class);
+            next_set.insert(next_set.end(), targets.begin(), targets.end());
+        }
+        std::sort(next_set.begin(), next_set.end());
+        next_set.erase(std::unique(next_set.begin(), next_set.end()),
+                       next_set.end());
+    }
+
+  public:
+    LazyDFA() = default;
+    LazyDFA(CompactTable const &table, DFACacheConfig config)
+        : config(config), row_width(table.class_count()),
+          boundaries(table.has_boundaries()) {
+        rebuild_base(table);
+    }
+
+    // where a thread starts, given the byte before it
+    uint32_t start_state(bool prev_word = false) const {
+        return prev_word ? start_after_word_id : start_id;
+    }
+
+    // what next() returns is a state, plus MATCHED_BEFORE with boundaries
+    static uint32_t target(uint32_t transition) {
+        return transition & ~MATCHED_BEFORE;
+    }
+
+    static bool matched_before(uint32_t transition) {
+        return (transition & MATCHED_BEFORE) != 0;
+    }
+
+    bool is_accepting(uint32_t dfa_state) const {
+        return accepting[dfa_state];
+    }
+
+    StateSet const &nfa_states(uint32_t dfa_state) const {
+        return state_sets[dfa_state];
+    }
+
+    // whether the state matches once the input ends right after it
+    bool accepts_at_end(CompactTable const &table, uint32_t dfa_state) {
+        return boundaries && close_boundaries(table, dfa_state, false);
+    }
+
+    uint32_t next(CompactTable const &table, uint32_t dfa_state, char c) {
+        if ((unsigned char)c >= CompactTable::ALPHABET) {
+            // nothing in the table ever moves on these, but a non-word byte
+            // can still finish a \b
+            return boundaries && close_boundaries(table, dfa_state, false)
+                       ? DEAD | MATCHED_BEFORE
+                       : DEAD;
+        }
+
+        // chars in the same class always lead to the same state, so they
+        // share a cache entry too
+        size_t byte_class = table.byte_class(c);
+        uint32_t &cached = transitions[dfa_state * row_width + byte_class];
+        if (cached != UNKNOWN) {
+            ++stats.hits;
+            return cached;
+        }
+        ++stats.misses;
+
+        uint32_t target = DEAD;
+        if (!boundaries) {
+            next_set = state_sets[dfa_state];
+            step_next_set(table, byte_class);
+            target = intern(table, next_set);
+        } else if (c == BOL_SYMBOL) {
+            // only ever fed to a fresh thread, before the first byte
+            next_set = state_sets[dfa_state];
+            step_next_set(table, byte_class);
+            target = next_set.empty() ? DEAD : intern(table, next_set);
+        } else {
+            // EOL is only checked where the line ends, which is non-word
+            bool next_word = c != EOL_SYMBOL && is_word_char(c);
+            bool matched = close_boundaries(table, dfa_state, next_word);
+            step_next_set(table, byte_class);
+            target = next_set.empty() ? DEAD
+                                      : intern(table, next_set, next_word);
+            if (matched) {
+                target |= MATCHED_BEFORE;
+            }
+        }
+        // intern can grow the transitions, so don't go through `cached`
+        transitions[dfa_state * row_width + byte_class] = target;
+        return target;
+    }
+
+    // every state cached right now, ids are always below this
+    size_t state_count() const {
+        return state_sets.size();
+    }
+
+    bool over_budget() const {
+        return stats.bytes > config.memory_budget;
+    }
+
+    // throws away every cached state except the ones still in use, whose
+    // ids are rewritten in place. returns false once the cache is thrashing
+    // badly enough that the caller should stop using the dfa
+    bool reset_cache(CompactTable const &table,
+                     std::vector<uint32_t> &live_states) {
+        std::vector<StateSet> live_sets;
+        std::vector<bool> live_after_word;
+        live_sets.reserve(live_states.size());
+        for (uint32_t id : live_states) {
+            live_sets.push_back(state_sets[id]);
+            live_after_word.push_back(after_word[id]);
+        }
+
+        rebuild_base(table);
+        for (size_t idx = 0; idx < live_states.size(); ++idx) {
+            live_states[idx] = intern(table, std::move(live_sets[idx]),
+                                      live_after_word[idx]);
+        }
+
+        ++stats.clears;
+        if (stats.hits - hits_at_last_clear < config.min_hits_between_clears) {
+            ++thrashing_clears;
+        } else {
+            thrashing_clears = 0;
+        }
+        hits_at_last_clear = stats.hits;
+
+        if (thrashing_clears >= config.max_thrashing_clears) {
+            // the scanner hands its threads to the nfa for good and never
+            // asks again, see Scanner::dfa_fallback
+            ++stats.fallbacks;
+            return false;
+        }
+        return true;
+    }
+
+    DFACacheStats const &get_stats() const {
+        return stats;
+    }
+};
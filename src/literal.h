@@ -0,0 +1,247 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// finds every (possibly overlapping) occurrence of a set of literals,
+// which is exactly what the automaton would report for such patterns.
+// a single literal goes through memmem, several (or a case insensitive one)
+// go through a dense aho-corasick automaton
+class LiteralSearcher {
+    static constexpr size_t ALPHABET = 128;
+    static constexpr uint32_t ROOT = 0;
+    static constexpr uint32_t UNSET = std::numeric_limits<uint32_t>::max();
+
+    std::vector<std::string> literals;
+    bool icase = false;
+
+    // goto and fail links folded into a full table, ALPHABET entries per
+    // state, so the scan does exactly one load per byte
+    std::vector<uint32_t> transitions;
+    // lengths of the literals ending in each state, longest first so the
+    // starting offsets come out in increasing order.
+    // state s owns output_lengths[output_offsets[s], output_offsets[s + 1])
+    std::vector<uint32_t> output_offsets;
+    std::vector<uint32_t> output_lengths;
+    // bytes that can leave the root, everything else is skipped in a tight
+    // loop
+    std::array<bool, 256> first_bytes{};
+    size_t longest = 0;
+
+    static unsigned char to_lower(unsigned char c) {
+        return c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+    }
+
+    static unsigned char to_upper(unsigned char c) {
+        return c >= 'a' && c <= 'z' ? (unsigned char)(c - 'a' + 'A') : c;
+    }
+
+    uint32_t add_state() {
+        transitions.resize(transitions.size() + ALPHABET, UNSET);
+        return (uint32_t)(transitions.size() / ALPHABET - 1);
+    }
+
+    uint32_t &next(uint32_t state, unsigned char c) {
+        return transitions[state * ALPHABET + c];
+    }
+
+    void build_automaton() {
+        std::vector<std::vector<uint32_t>> outputs;
+
+        // the trie
+        add_state();
+        outputs.emplace_back();
+        for (auto const &literal : literals) {
+            uint32_t curr = ROOT;
+            for (char ch : literal) {
+                unsigned char c = (unsigned char)ch;
+                if (next(curr, c) == UNSET) {
+                    uint32_t new_state = add_state();
+                    outputs.emplace_back();
+                    next(curr, c) = new_state;
+                }
+                curr = next(curr, c);
+            }
+            outputs[curr].push_back((uint32_t)literal.size());
+        }
+
+        // fail links, breadth first so the fail target is always done
+        std::vector<uint32_t> fail(outputs.size(), ROOT);
+        std::queue<uint32_t> to_visit;
+        for (size_t c = 0; c < ALPHABET; ++c) {
+            uint32_t &target = next(ROOT, (unsigned char)c);
+            if (target == UNSET) {
+                target = ROOT;
+            } else {
+                to_visit.push(target);
+            }
+        }
+
+        while (!to_visit.empty()) {
+            uint32_t curr = to_visit.front();
+            to_visit.pop();
+            auto const &inherited = outputs[fail[curr]];
+            outputs[curr].insert(outputs[curr].end(), inherited.begin(),
+                                 inherited.end());
+
+            for (size_t c = 0; c < ALPHABET; ++c) {
+                uint32_t fallback = next(fail[curr], (unsigned char)c);
+                uint32_t &target = next(curr, (unsigned char)c);
+                if (target == UNSET) {
+                    target = fallback;
+                } else {
+                    fail[target] = fallback;
+                    to_visit.push(target);
+                }
+            }
+        }
+
+        // the literals are all lower case by now, so an upper case letter
+        // just goes wherever its lower case does
+        if (icase) {
+            for (size_t s = 0; s < outputs.size(); ++s) {
+                for (unsigned char c = 'A'; c <= 'Z'; ++c) {
+                    next((uint32_t)s, c) = next((uint32_t)s, to_lower(c));
+                }
+            }
+        }
+
+        // flatten the outputs
+        output_offsets.push_back(0);
+        for (auto &lengths : outputs) {
+            std::sort(lengths.begin(), lengths.end(), std::greater<>());
+            output_lengths.insert(output_lengths.end(), lengths.begin(),
+                                  lengths.end());
+            output_offsets.push_back((uint32_t)output_lengths.size());
+        }
+    }
+
+  public:
+    LiteralSearcher() = default;
+
+    // literals are expected to be non-empty and below ALPHABET
+    explicit LiteralSearcher(std::vector<std::string> init_literals,
+                             bool init_icase = false)
+        : literals(std::move(init_literals)), icase(init_icase) {
+        if (icase) {
+            for (auto &literal : literals) {
+                std::transform(literal.begin(), literal.end(), literal.begin(),
+                               [](char c) {
+                                   return (char)to_lower((unsigned char)c);
+                               });
+            }
+        }
+        // the same literal twice still only matches once per offset
+        std::sort(literals.begin(), literals.end());
+        literals.erase(std::unique(literals.begin(), literals.end()),
+                       literals.end());
+
+        for (auto const &literal : literals) {
+            longest = std::max(longest, literal.size());
+            unsigned char first = (unsigned char)literal.front();
+            first_bytes[first] = true;
+            if (icase) {
+                first_bytes[to_upper(first)] = true;
+            }
+        }
+
+        if (literals.size() > 1 || icase) {
+            build_automaton();
+        }
+    }
+
+    size_t size() const {
+        return literals.size();
+    }
+
+    size_t max_length() const {
+        return longest;
+    }
+
+    // where a search stopped, so it can carry on from there
+    struct Cursor {
+        size_t pos = 0;
+        uint32_t state = ROOT;
+    };
+
+    // calls on_match(starting_offset, ending_offset) for the occurrences
+    // ending at the next offset that has any, ordered by starting offset.
+    // returns false once str has none left
+    template <typename F>
+    bool next_matches(std::string_view str, Cursor &cursor,
+                      F &&on_match) const {
+        if (literals.empty()) {
+            return false;
+        }
+
+        if (literals.size() == 1 && !icase) {
+            std::string const &literal = literals.front();
+            if (cursor.pos >= str.size()) {
+                return false;
+            }
+            void const *hit =
+                memmem(str.data() + cursor.pos, str.size() - cursor.pos,
+                       literal.data(), literal.size());
+            if (hit == nullptr) {
+                cursor.pos = str.size();
+                return false;
+            }
+            size_t start = (size_t)((char const *)hit - str.data());
+            on_match(start, start + literal.size());
+            // occurrences can overlap
+            cursor.pos = start + 1;
+            return true;
+        }
+
+        uint32_t state = cursor.state;
+        for (size_t idx = cursor.pos; idx < str.size(); ++idx) {
+            if (state == ROOT) {
+                while (idx < str.size() &&
+                       !first_bytes[(unsigned char)str[idx]]) {
+                    ++idx;
+                }
+                if (idx == str.size()) {
+                    break;
+                }
+            }
+
+            unsigned char c = (unsigned char)str[idx];
+            if (c >= ALPHABET) {
+                // no literal can go through this byte
+                state = ROOT;
+                continue;
+            }
+
+            state = transitions[state * ALPHABET + c];
+            if (output_offsets[state] == output_offsets[state + 1]) {
+                continue;
+            }
+            for (uint32_t out = output_offsets[state];
+                 out < output_offsets[state + 1]; ++out) {
+                on_match(idx + 1 - output_lengths[out], idx + 1);
+            }
+            cursor = {idx + 1, state};
+            return true;
+        }
+        cursor = {str.size(), ROOT};
+        return false;
+    }
+
+    // calls on_match(starting_offset, ending_offset) for every occurrence,
+    // ordered by ending offset and then by starting offset
+    template <typename F>
+    void for_each_match(std::string_view str, F &&on_match) const {
+        Cursor cursor;
+        while (next_matches(str, cursor, on_match)) {
+        }
+    }
+};
@@ -1,69 +1,531 @@
+#include "compile_many.h"
+#include "compiled_regex.h"
+#include "decompressor.h"
+#include "empty_matches.h"
+#include "file_walker.h"
+#include "input_file.h"
 #include "matcher.h"
-#include "parser.h"
+#include "read_pipeline.h"
+#include "sink.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// grep over the Matcher:
+//   main.out [-cohHnriz] [-j threads] pattern [path...]
+//   main.out [-cohHnriz] [-j threads] -f pattern_file [path...]
+// every line with a match gets printed, or every match with -o. without
+// paths it reads stdin. the exit status is 0 if something matched, 1 if
+// nothing did and 2 on any error, the same as grep
+
+namespace {
+
+char const *program_name = "main.out";
+
+struct CliOptions {
+    // print how many lines matched per input instead of the lines
+    bool count = false;
+    // print every match on its own line instead of the line it's in
+    bool only_matching = false;
+    bool line_numbers = false;
+    // unset means only with more than one input
+    std::optional<bool> with_filename;
+    bool recursive = false;
+    bool icase = false;
+    // search gzip and zstd inputs as what they decompress to
+    bool decompress = false;
+    size_t threads = 0;
+    std::string pattern;
+    // one pattern per line, a line matches if any of them does
+    std::optional<std::string> pattern_file;
+    std::vector<std::string> paths;
+};
+
+[[noreturn]] void usage() {
+    std::cerr << "usage: " << program_name
+              << " [-cohHnriz] [-j threads] pattern [path...]" << std::endl;
+    std::cerr << "       " << program_name
+              << " [-cohHnriz] [-j threads] -f pattern_file [path...]"
+              << std::endl;
+    std::cerr << "  -c  count the matching lines of every input" << std::endl;
+    std::cerr << "  -o  print only the matches, one per line" << std::endl;
+    std::cerr << "  -n  prefix every line with its line number" << std::endl;
+    std::cerr << "  -H  prefix every line with its file name" << std::endl;
+    std::cerr << "  -h  never prefix with the file name" << std::endl;
+    std::cerr << "  -r  search directories recursively" << std::endl;
+    std::cerr << "  -i  ignore case" << std::endl;
+    std::cerr << "  -z  decompress gzip and zstd inputs" << std::endl;
+    std::cerr << "  -f  read the patterns from a file, one per line"
+              << std::endl;
+    std::cerr << "  -j  number of threads, all the cores by default"
+              << std::endl;
+    exit(2);
+}
+
+std::optional<size_t> parse_count(char const *str) {
+    char *end = nullptr;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || value == 0) {
+        return {};
+    }
+    return (size_t)value;
+}
+
+CliOptions parse_args(int argc, char **argv) {
+    CliOptions options;
+    int arg_idx = 1;
+    for (; arg_idx < argc; ++arg_idx) {
+        char const *arg = argv[arg_idx];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (strcmp(arg, "--") == 0) {
+            ++arg_idx;
+            break;
+        }
+        if (strcmp(arg, "--help") == 0) {
+            usage();
+        }
+        // flags can be bundled, like -rn
+        for (char const *flag = arg + 1; *flag != '\0'; ++flag) {
+            switch (*flag) {
+            case 'c':
+                options.count = true;
+                break;
+            case 'o':
+                options.only_matching = true;
+                break;
+            case 'n':
+                options.line_numbers = true;
+                break;
+            case 'H':
+                options.with_filename = true;
+                break;
+            case 'h':
+                options.with_filename = false;
+                break;
+            case 'r':
+                options.recursive = true;
+                break;
+            case 'i':
+                options.icase = true;
+                break;
+            case 'z':
+                options.decompress = true;
+                break;
+            case 'j': {
+                // either -j4 or -j 4
+                char const *value = flag[1] != '\0' ? flag + 1
+                                    : arg_idx + 1 < argc ? argv[++arg_idx]
+                                                         : "";
+                auto threads = parse_count(value);
+                if (!threads) {
+                    std::cerr << program_name << ": invalid thread count"
+                              << std::endl;
+                    usage();
+                }
+                options.threads = *threads;
+                flag = value + strlen(value) - 1;
+                break;
+            }
+            case 'f': {
+                // either -fpatterns or -f patterns
+                char const *value = flag[1] != '\0' ? flag + 1
+                                    : arg_idx + 1 < argc ? argv[++arg_idx]
+                                                         : nullptr;
+                if (value == nullptr) {
+                    std::cerr << program_name << ": -f needs a file"
+                              << std::endl;
+                    usage();
+                }
+                options.pattern_file = value;
+                flag = value + strlen(value) - 1;
+                break;
+            }
+            default:
+                std::cerr << program_name << ": unknown option -" << *flag
+                          << std::endl;
+                usage();
+            }
+        }
+    }
+
+    if (!options.pattern_file) {
+        if (arg_idx == argc) {
+            usage();
+        }
+        options.pattern = argv[arg_idx++];
+    }
+    for (; arg_idx < argc; ++arg_idx) {
+        options.paths.emplace_back(argv[arg_idx]);
+    }
+    return options;
+}
 
-int main() {
-    // std::string input_line;
-    // std::cout << "enter line to parse" << std::endl;
-    // while (std::getline(std::cin, input_line)) {
-    //     auto maybe_res = tokenize(input_line);
-    //     if (!maybe_res) {
-    //         std::cout << "tokenize results: tokenize error" << std::endl;
-    //         continue;
-    //     }
-    //     auto token_res = *maybe_res;
-    //     std::cout << "tokenize results:" << std::endl;
-    //     while (!token_res.empty()) {
-    //         std::cout << token_res.pop() << std::endl;
-    //     }
-    //     // check to make sure the terminator is in
-    //     std::cout << token_res.pop() << std::endl;
-    //     token_res.reset_state();
-
-    //     bool validation_res = validate(token_res);
-    //     std::cout << "====================" << std::endl;
-    //     std::cout << ((validation_res) ? "passed the parser"
-    //                                    : "failed the parser")
-    //               << std::endl;
-    //     std::cout << "====================" << std::endl;
-
-    //     std::cout << "enter line to parse" << std::endl;
-    // }
-
-    // Matcher m{"abc"};
-    // auto token_stack = tokenize("abc");
-    // if (!token_stack) {
-    //     throw std::runtime_error("invalid regex pattern");
-    // }
-
-    // std::cout << "token stack" << std::endl;
-    // std::cout << *token_stack << std::endl;
-
-    // if (!validate(*token_stack)) {
-    //     throw std::runtime_error("invalid regex pattern");
-    // }
-    // (*token_stack).reset_state();
-
-    // std::cout << "empty check : " << (*token_stack).empty() << std::endl;
-
-    // auto table = compile(*token_stack);
-    // std::cout << table << std::endl;
-
-    Matcher m{"[\\W]", false};
-    std::cout << "table contents:=================== " << std::endl;
-    std::cout << m << std::endl;
-    auto results = m.match("\t aAbBgG 1234");
-    if (results.empty()) {
-        std::cout << "no matches" << std::endl;
+// everything one worker needs to search a file, reused from one file to
+// the next so a worker stops allocating once it has warmed up
+struct Worker {
+    Scanner scanner;
+    EmptyMatches empty_matches;
+    std::string read_buffer;
+    bool matched = false;
+    bool failed = false;
+
+    explicit Worker(CompiledRegexPtr regex)
+        : scanner(std::move(regex)), empty_matches(*scanner.get_regex()) {
+    }
+};
+
+void append_prefix(std::string &out, CliOptions const &options,
+                   std::string_view label, size_t line_number) {
+    if (*options.with_filename) {
+        out.append(label);
+        out.push_back(':');
+    }
+    if (options.line_numbers) {
+        out.append(std::to_string(line_number));
+        out.push_back(':');
+    }
+}
+
+// searches a run of whole lines, the first of them numbered first_line, and
+// appends what grep would print for them to out. returns how many matched
+size_t search_lines(Worker &worker, std::string_view contents,
+                    std::string_view label, CliOptions const &options,
+                    size_t first_line, std::string &out) {
+    size_t matching_lines = 0;
+    // the line number of counted_up_to, found by counting newlines
+    size_t line_number = first_line;
+    size_t counted_up_to = 0;
+    // where the first line not looked at yet begins
+    size_t next_line = 0;
+    // a pattern that can match the empty string has to look at every line,
+    // the rest only at the lines their matches are on
+    bool every_line = worker.empty_matches.any();
+
+    auto line_start_of = [contents](size_t pos) {
+        size_t newline = pos == 0 ? std::string_view::npos
+                                  : contents.rfind('\n', pos - 1);
+        return newline == std::string_view::npos ? 0 : newline + 1;
+    };
+    auto line_end_of = [contents](size_t line_begin) {
+        size_t line_end = contents.find('\n', line_begin);
+        return line_end == std::string_view::npos ? contents.size()
+                                                  : line_end;
+    };
+    auto select_line = [&](size_t line_begin, size_t line_end) {
+        ++matching_lines;
+        if (options.line_numbers) {
+            line_number += (size_t)std::count(
+                contents.begin() + (ptrdiff_t)counted_up_to,
+                contents.begin() + (ptrdiff_t)line_begin, '\n');
+            counted_up_to = line_begin;
+        }
+        if (!options.count && !options.only_matching) {
+            append_prefix(out, options, label, line_number);
+            out.append(contents.substr(line_begin, line_end - line_begin));
+            out.push_back('\n');
+        }
+        next_line = line_end + 1;
+    };
+    // the lines before line_begin that nothing matched on still get picked
+    // for an empty match
+    auto skip_to = [&](size_t line_begin) {
+        while (every_line && next_line < line_begin) {
+            size_t line_end = line_end_of(next_line);
+            if (worker.empty_matches.fits(
+                    contents.substr(next_line, line_end - next_line))) {
+                select_line(next_line, line_end);
+            } else {
+                next_line = line_end + 1;
+            }
+        }
+    };
+
+    if (options.only_matching && !options.count) {
+        // leftmost longest and never overlapping, like grep -o
+        size_t line_end = 0;
+        worker.scanner.match_leftmost_longest(
+            contents, [&](size_t starting_offset, size_t ending_offset) {
+                if (starting_offset >= next_line) {
+                    size_t line_begin = line_start_of(starting_offset);
+                    skip_to(line_begin);
+                    line_end = line_end_of(line_begin);
+                    select_line(line_begin, line_end);
+                }
+                // a $ match takes the newline along, the line ends anyway
+                size_t match_end = std::min(ending_offset, line_end);
+                if (match_end > starting_offset) {
+                    append_prefix(out, options, label, line_number);
+                    out.append(contents.substr(starting_offset,
+                                               match_end - starting_offset));
+                    out.push_back('\n');
+                }
+            });
+    } else {
+        // one match is all a line needs, the scan for the next one starts
+        // on the line after
+        while (next_line < contents.size()) {
+            auto match =
+                worker.scanner.first_match(contents.substr(next_line));
+            if (!match) {
+                break;
+            }
+            size_t line_begin =
+                line_start_of(next_line + match->starting_offset);
+            skip_to(line_begin);
+            select_line(line_begin, line_end_of(line_begin));
+        }
+    }
+    skip_to(contents.size());
+
+    return matching_lines;
+}
+
+// searches one input and appends what grep would print for it to out.
+// returns whether any line matched
+bool search(Worker &worker, InputFile const &input, std::string const &label,
+            CliOptions const &options, std::string &out) {
+    size_t matching_lines = 0;
+    if (!input.streamed()) {
+        matching_lines =
+            search_lines(worker, input.contents(), label, options, 1, out);
     } else {
-        std::cout << "match list:=======================" << std::endl;
-        for (auto res : results) {
-            std::cout << "{ starting offset: " << res.starting_offset << "; ";
-            std::cout << "ending offset: " << res.ending_offset << "}"
+        // decompressing overlaps the scan on a thread of its own, in
+        // place of the reads
+        std::optional<Decompressor> decompressor;
+        std::optional<ReadPipeline> pipeline;
+        if (options.decompress) {
+            decompressor.emplace(input.descriptor(), label);
+            pipeline.emplace(label, [&decompressor](char *buf, size_t len) {
+                return decompressor->read(buf, len);
+            });
+        } else {
+            pipeline.emplace(input.descriptor(), label);
+        }
+        size_t line_number = 1;
+        for (auto lines = pipeline->next_lines(); !lines.empty();
+             lines = pipeline->next_lines()) {
+            matching_lines += search_lines(worker, lines, label, options,
+                                           line_number, out);
+            if (options.line_numbers) {
+                line_number += (size_t)std::count(lines.begin(), lines.end(),
+                                                  '\n');
+            }
+        }
+    }
+
+    if (options.count) {
+        if (*options.with_filename) {
+            out.append(label);
+            out.push_back(':');
+        }
+        out.append(std::to_string(matching_lines));
+        out.push_back('\n');
+    }
+    return matching_lines > 0;
+}
+
+void write_out(std::string_view text) {
+    while (!text.empty()) {
+        ssize_t written = write(STDOUT_FILENO, text.data(), text.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // most likely a closed pipe, nobody is listening anymore. the
+            // walk writes from its workers, and exit() would tear down
+            // what the others are still using
+            _exit(2);
+        }
+        text.remove_prefix((size_t)written);
+    }
+}
+
+int search_stdin(CliOptions const &options, CompiledRegexPtr regex) {
+    Worker worker(std::move(regex));
+    std::string out;
+    try {
+        std::string label = "(standard input)";
+        InputFile input(STDIN_FILENO, label, worker.read_buffer,
+                        options.decompress);
+        worker.matched = search(worker, input, label, options, out);
+    } catch (std::exception const &e) {
+        std::cerr << program_name << ": " << e.what() << std::endl;
+        return 2;
+    }
+    write_out(out);
+    return worker.matched ? 0 : 1;
+}
+
+// the outputs of a walk, written in walk order whichever thread got to
+// which file, each as soon as everything before it is written
+class OrderedOutput {
+    std::mutex lock;
+    std::map<std::vector<uint32_t>, std::string> waiting;
+
+  public:
+    void add(std::vector<uint32_t> key, std::string text) {
+        std::lock_guard guard(lock);
+        waiting.emplace(std::move(key), std::move(text));
+    }
+
+    // writes whatever is waiting below first_unfinished, everything if
+    // it's nullptr
+    void flush(std::vector<uint32_t> const *first_unfinished) {
+        std::lock_guard guard(lock);
+        auto end = first_unfinished == nullptr
+                       ? waiting.end()
+                       : waiting.lower_bound(*first_unfinished);
+        for (auto it = waiting.begin(); it != end;) {
+            write_out(it->second);
+            it = waiting.erase(it);
+        }
+    }
+};
+
+int search_paths(CliOptions const &options, CompiledRegexPtr const &regex) {
+    FileWalker walker({options.recursive, options.threads});
+
+    std::vector<Worker> workers;
+    workers.reserve(walker.thread_count());
+    for (size_t idx = 0; idx < walker.thread_count(); ++idx) {
+        workers.emplace_back(regex);
+    }
+
+    // errors go out as they happen, like grep, but never interleaved
+    std::mutex error_lock;
+    OrderedOutput output;
+    walker.run(
+        options.paths,
+        [&workers, &options, &error_lock, &output](size_t worker_idx,
+                                                   WalkItem const &item) {
+            Worker &worker = workers[worker_idx];
+            std::string label = item.path.string();
+            std::string text;
+            try {
+                InputFile input(label, worker.read_buffer,
+                                options.decompress);
+                worker.matched |= search(worker, input, label, options, text);
+            } catch (std::exception const &e) {
+                worker.failed = true;
+                std::lock_guard guard(error_lock);
+                std::cerr << program_name << ": " << e.what() << std::endl;
+                return;
+            }
+            if (!text.empty()) {
+                output.add(item.key, std::move(text));
+            }
+        },
+        [&workers, &error_lock](size_t worker_idx, std::string const &error) {
+            workers[worker_idx].failed = true;
+            std::lock_guard guard(error_lock);
+            std::cerr << program_name << ": " << error << std::endl;
+        },
+        [&output](size_t, std::vector<uint32_t> const *first_unfinished) {
+            output.flush(first_unfinished);
+        });
+
+    bool matched = false;
+    bool failed = false;
+    for (auto const &worker : workers) {
+        matched = matched || worker.matched;
+        failed = failed || worker.failed;
+    }
+
+    if (failed) {
+        return 2;
+    }
+    return matched ? 0 : 1;
+}
+
+// compiles the patterns of -f into one regex, on all the threads. the ones
+// that don't compile get reported and left out, the rest still get searched
+// for. unset if none is left
+CompiledRegexPtr compile_pattern_file(CliOptions const &options,
+                                      bool &bad_patterns) {
+    std::ifstream file(*options.pattern_file);
+    if (!file) {
+        throw std::runtime_error(*options.pattern_file + ": " +
+                                 strerror(errno));
+    }
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);) {
+        lines.push_back(std::move(line));
+    }
+    std::vector<std::string_view> patterns(lines.begin(), lines.end());
+
+    CompiledSet set =
+        compile_many(patterns, {.compile = {.icase = options.icase},
+                                .threads = options.threads,
+                                .per_pattern = false,
+                                .combined = true});
+    for (size_t idx = 0; idx < set.patterns.size(); ++idx) {
+        if (!set.patterns[idx].ok()) {
+            bad_patterns = true;
+            std::cerr << program_name << ": " << *options.pattern_file << ":"
+                      << idx + 1 << ": " << set.patterns[idx].error
                       << std::endl;
         }
     }
+    return set.combined;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc > 0) {
+        program_name = argv[0];
+    }
+    CliOptions options = parse_args(argc, argv);
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    CompiledRegexPtr regex;
+    bool bad_patterns = false;
+    try {
+        if (options.pattern_file) {
+            regex = compile_pattern_file(options, bad_patterns);
+        } else {
+            regex = compile_regex(options.pattern, {.icase = options.icase});
+        }
+    } catch (std::exception const &e) {
+        std::cerr << program_name << ": " << e.what() << std::endl;
+        return 2;
+    }
+    if (!regex) {
+        // nothing to look for, so nothing matches
+        return bad_patterns ? 2 : 1;
+    }
+
+    int status = 0;
+    if (options.paths.empty()) {
+        options.with_filename = options.with_filename.value_or(false);
+        status = search_stdin(options, std::move(regex));
+        return bad_patterns ? 2 : status;
+    }
+    if (!options.with_filename) {
+        std::error_code ec;
+        options.with_filename =
+            options.paths.size() > 1 ||
+            (options.recursive &&
+             std::filesystem::is_directory(options.paths.front(), ec));
+    }
+    status = search_paths(options, regex);
+    return bad_patterns ? 2 : status;
 }
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "sink.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <string_view>
+
+// the leftmost longest matches of an input as a range that finds them while
+// it gets walked. the scanner only steps as far as the next match, so
+// std::views::take(1) stops right after the first one, and nothing gets
+// allocated per match. the iterators only look for the next match once
+// it's asked for, since take() increments past the last one it keeps.
+// Source is a Scanner, see Scanner::matches(). a scanner runs one walk at
+// a time: starting another one, or calling any of its match functions, ends
+// the one before, and its iterators compare equal to end() from then on
+template <typename Source>
+class MatchView : public std::ranges::view_interface<MatchView<Source>> {
+    Source *source = nullptr;
+    std::string_view str;
+
+  public:
+    class iterator {
+        Source *source = nullptr;
+        // the match call of the scanner this walk is
+        uint64_t generation = 0;
+        mutable std::optional<Result> current;
+        mutable bool stale = true;
+
+        void fetch() const {
+            if (source->generation != generation) {
+                // the scanner moved on, whatever it was in the middle of
+                current.reset();
+                stale = false;
+                return;
+            }
+            if (stale) {
+                current = source->lazy_next();
+                stale = false;
+            }
+        }
+
+      public:
+        using value_type = Result;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        explicit iterator(Source *init_source)
+            : source(init_source), generation(init_source->generation) {
+        }
+
+        Result const &operator*() const {
+            fetch();
+            return *current;
+        }
+
+        Result const *operator->() const {
+            fetch();
+            return &*current;
+        }
+
+        iterator &operator++() {
+            // skip the current one if nobody looked at it yet
+            fetch();
+            stale = true;
+            return *this;
+        }
+
+        void operator++(int) {
+            ++*this;
+        }
+
+        friend bool operator==(iterator const &it, std::default_sentinel_t) {
+            it.fetch();
+            return !it.current;
+        }
+    };
+
+    MatchView() = default;
+
+    MatchView(Source &init_source, std::string_view init_str)
+        : source(&init_source), str(init_str) {
+    }
+
+    // every begin() starts the scan over
+    iterator begin() {
+        source->lazy_begin(str);
+        return iterator(source);
+    }
+
+    std::default_sentinel_t end() const {
+        return {};
+    }
+};
+
+// the pieces of an input between its leftmost longest matches, found the
+// same way. n matches make n + 1 pieces, empty ones included, so splitting
+// an empty input gives one empty piece
+template <typename Source>
+class SplitView : public std::ranges::view_interface<SplitView<Source>> {
+    Source *source = nullptr;
+    std::string_view str;
+
+  public:
+    class iterator {
+        Source *source = nullptr;
+        std::string_view str;
+        // where the piece after the current one begins, npos once the
+        // current one is the last
+        mutable size_t next_begin = 0;
+        mutable std::string_view current;
+        mutable bool done = false;
+        mutable bool stale = true;
+        uint64_t generation = 0;
+
+        void fetch() const {
+            if (source->generation != generation) {
+                done = true;
+                stale = false;
+                return;
+            }
+            if (!stale) {
+                return;
+            }
+            stale = false;
+            if (next_begin == std::string_view::npos) {
+                done = true;
+                return;
+            }
+            if (auto match = source->lazy_next()) {
+                current = str.substr(next_begin,
+                                     match->starting_offset - next_begin);
+                next_begin = match->ending_offset;
+            } else {
+                current = str.substr(next_begin);
+                next_begin = std::string_view::npos;
+            }
+        }
+
+      public:
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        iterator(Source *init_source, std::string_view init_str)
+            : source(init_source), str(init_str),
+              generation(init_source->generation) {
+        }
+
+        std::string_view const &operator*() const {
+            fetch();
+            return current;
+        }
+
+        iterator &operator++() {
+            fetch();
+            stale = true;
+            return *this;
+        }
+
+        void operator++(int) {
+            ++*this;
+        }
+
+        friend bool operator==(iterator const &it, std::default_sentinel_t) {
+            it.fetch();
+            return it.done;
+        }
+    };
+
+    SplitView() = default;
+
+    SplitView(Source &init_source, std::string_view init_str)
+        : source(&init_source), str(init_str) {
+    }
+
+    iterator begin() {
+        source->lazy_begin(str);
+        return iterator(source, str);
+    }
+
+    std::default_sentinel_t end() const {
+        return {};
+    }
+};
@@ -1,191 +1,1182 @@
 #pragma once
 
-#include "TransitionTable.h"
-#include "parser.h"
+#include "CompactTable.h"
+#include "analyzer.h"
+#include "compiled_regex.h"
+#include "lazy_dfa.h"
+#include "match_ranges.h"
+#include "replace.h"
+#include "resource_limits.h"
+#include "sink.h"
+#include "stats.h"
 
 #include <algorithm>
 #include <array>
+#include <concepts>
 #include <list>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-struct Result {
+struct ScanOptions {
+    // scan the input as one continuous buffer instead of line by line, so
+    // matches can span newlines
+    bool whole_buffer = false;
+    // with whole_buffer, whether ^ and $ match around every newline or only
+    // at the ends of the buffer. line by line they always match per line
+    bool line_anchors = true;
+    // a scan throws LimitError once more threads than this are alive at the
+    // same offset. every offset can start a thread, so without a limit a
+    // pattern like a.* keeps one per byte of the line alive
+    size_t max_active_threads = NO_LIMIT;
+    // and once one match call (or one feed of a stream) has stepped more
+    // threads than this in total, one step being one thread over one byte.
+    // literal patterns never step threads and never hit either
+    size_t max_steps = NO_LIMIT;
+};
+
+// one match out of match_batch, offsets are relative to the record
+struct BatchResult {
+    size_t record_idx;
     size_t offset;
     size_t length;
 };
 
-class Matcher {
+// the per-thread half of matching: the threads, the dfa cache and all the
+// scratch space. it only reads the CompiledRegex it scans with, so any number
+// of scanners can share one. a single scanner is not thread safe
+class Scanner {
+    friend class StreamMatcher;
+    template <typename>
+    friend class MatchView;
+    template <typename>
+    friend class SplitView;
+
+    // threads that end up in the same states would step the same way and
+    // match at the same ends from then on, so they get merged into the
+    // oldest one and stepped once. it keeps the starts of the others in
+    // merged_offsets, every match is still reported for every start
     struct State {
-        std::unordered_set<TransitionTable::State, TransitionTable::State::Hash>
-            fa_states;
+        std::unordered_set<CompactTable::StateId> fa_states;
         size_t starting_offset;
         size_t ending_offset;
+        std::vector<size_t> merged_offsets;
     };
 
-    struct Result {
+    // the lazy dfa counterpart of State
+    struct DFAThread {
+        uint32_t dfa_state;
         size_t starting_offset;
-        size_t ending_offset;
+        std::vector<size_t> merged_offsets;
     };
 
-    TransitionTable table;
-    std::vector<State> active_matches;
-
-    // to disable multi-line matching. it will retain the newlines
-    // to help match against ^
-    static std::vector<std::string_view> break_into_lines(std::string_view sv) {
-        std::vector<std::string_view> to_ret;
-        while (!sv.empty()) {
-            size_t next_newl = sv.find('\n');
-            if (next_newl == std::string::npos) {
-                to_ret.push_back(sv);
-                sv = "";
-            } else {
-                // this should be ok. out_of_range is only thrown
-                // when (next_newl + 1) > sv.size()
-                to_ret.push_back(sv.substr(0, next_newl + 1));
-                sv = sv.substr(next_newl + 1);
-            }
-        }
-        return to_ret;
-    }
+    // the threads of one input that is being scanned, oldest first. these
+    // stick around between inputs so their storage gets reused
+    struct ScanLane {
+        std::vector<State> active_matches;
+        std::vector<DFAThread> dfa_threads;
+        // whether the last byte stepped over was a word char, for \b
+        bool prev_word = false;
+    };
+
+    // where an interleaved lane is in its record
+    struct LaneCursor {
+        size_t record_idx;
+        size_t pos;
+    };
+
+    CompiledRegexPtr regex;
+    ScanOptions options;
+
+    LazyDFA dfa;
+    // set for good once the dfa cache starts thrashing
+    bool dfa_fallback = false;
+
+    // the lane match() uses, and the ones match_batch interleaves
+    ScanLane main_lane;
+    std::vector<ScanLane> batch_lanes;
+    std::vector<LaneCursor> batch_cursors;
+    std::vector<std::vector<BatchResult>> batch_lane_results;
+
+    // the states a fresh thread starts in, and a fresh bol thread. worked
+    // out once, dead states left out, then copied into sets that finished
+    // threads left behind, so starting a thread at every offset doesn't
+    // allocate once the scan has warmed up
+    std::unordered_set<CompactTable::StateId> start_set;
+    std::unordered_set<CompactTable::StateId> bol_start_set;
+    std::vector<std::unordered_set<CompactTable::StateId>> spare_sets;
+
+    // scratch space for stepping a lane
+    std::vector<State> next_active_states;
+    std::unordered_set<CompactTable::StateId> temp_union;
+    std::vector<CompactTable::StateId> closure;
+    std::vector<DFAThread> next_dfa_threads;
+    std::vector<uint32_t> live_dfa_states;
+    // where the thread in a set of states went this step, to merge into it
+    std::unordered_map<uint64_t, size_t> nfa_merge_slots;
+    // the same by dfa state, stamped with the step so it never gets cleared
+    struct DFAMergeSlot {
+        uint64_t round = 0;
+        size_t thread_idx = 0;
+    };
+    std::vector<DFAMergeSlot> dfa_merge_slots;
+    uint64_t merge_round = 0;
+
+    // threads stepped since the current match call started, for max_steps
+    size_t steps_taken = 0;
+    // picks the matches of match_leftmost_longest and the ranges
+    LeftmostLongest leftmost;
+
+    // how far the scan behind matches() and split() has got
+    struct LazyScan {
+        std::string_view str;
+        size_t str_idx = 0;
+        LiteralSearcher::Cursor literal_cursor;
+        bool input_done = true;
+        // settled matches that weren't handed out yet
+        std::vector<Result> ready;
+        size_t ready_head = 0;
+    };
+    LazyScan lazy;
+    // bumped by every match call. the range iterators remember the one
+    // their walk started in, and end once another call took the scanner
+    uint64_t generation = 0;
+
+    // the last match() call, and everything since construction
+    MatcherStats last_stats;
+    MatcherStats total_stats;
 
   public:
-    Matcher(std::string_view pattern, bool reverse = false) {
-        // should we really be validating the token stack in the matcher?
-        auto token_stack = tokenize(pattern);
-        if (!token_stack) {
-            throw std::runtime_error("invalid tokenization");
+    explicit Scanner(CompiledRegexPtr compiled_regex,
+                     DFACacheConfig dfa_cache_config = {},
+                     ScanOptions scan_options = {})
+        : regex(std::move(compiled_regex)), options(scan_options) {
+        if (!regex) {
+            throw std::runtime_error("scanner needs a compiled regex");
         }
-        (*token_stack).reset_state();
-        if (!validate(*token_stack)) {
-            throw std::runtime_error("invalid regex pattern");
+        total_stats.compile_ns = regex->get_compile_ns();
+        if (regex->engine() == Engine::LAZY_DFA) {
+            dfa = LazyDFA(table(), dfa_cache_config);
+        }
+        for (auto fa_state : table().starting_states()) {
+            if (table().is_dead(fa_state)) {
+                continue;
+            }
+            start_set.insert(fa_state);
+            auto next_states = table().get_transition(fa_state, BOL_SYMBOL);
+            bol_start_set.insert(next_states.begin(), next_states.end());
         }
-        (*token_stack).reset_state();
-        table = compile(*token_stack, reverse);
+    }
+
+    CompiledRegexPtr const &get_regex() const {
+        return regex;
+    }
+
+    ScanOptions const &get_options() const {
+        return options;
+    }
+
+    void set_options(ScanOptions scan_options) {
+        options = scan_options;
+    }
+
+    Engine engine() const {
+        return regex->engine();
+    }
+
+    PatternAnalysis const &get_analysis() const {
+        return regex->get_analysis();
+    }
+
+    // what the analyzer saw in the pattern and which engine it picked
+    std::string explain() const {
+        return regex->explain();
+    }
+
+    DFACacheStats const &dfa_cache_stats() const {
+        return dfa.get_stats();
+    }
+
+    // all zeroes unless built with REGEX_STATS
+    MatcherStats const &last_match_stats() const {
+        return last_stats;
+    }
+
+    MatcherStats const &stats() const {
+        return total_stats;
+    }
+
+    // hands every match in str to sink(starting_offset, ending_offset) as
+    // soon as it's found, see sink.h
+    template <typename Sink>
+    void match(std::string_view str, Sink &&sink) {
+        check_sink_capacity<Sink>(str.size());
+        counted_scan(str, sink, [](size_t) {});
     }
 
     std::vector<Result> match(std::string_view str) {
-        std::vector<std::string_view> line_list = break_into_lines(str);
         std::vector<Result> total_results;
-        size_t running_base_offset = 0;
-
-        for (auto const &line : line_list) {
-            auto line_res = match_line(line);
-
-            // append the results
-            std::transform(line_res.begin(), line_res.end(),
-                           std::back_inserter(total_results),
-                           [running_base_offset](Result res) -> Result {
-                               return {res.starting_offset +
-                                           running_base_offset,
-                                       res.ending_offset + running_base_offset};
-                           });
+        match(str, [&total_results](size_t starting_offset,
+                                    size_t ending_offset) {
+            total_results.push_back({starting_offset, ending_offset});
+        });
+        return total_results;
+    }
+
+    size_t count(std::string_view str) {
+        CountSink sink;
+        match(str, sink);
+        return sink.count;
+    }
+
+    // the first match the scan comes across, and not a byte scanned past
+    // it. enough to tell whether str matches at all
+    std::optional<Result> first_match(std::string_view str) {
+        ++generation;
+        last_stats = {};
+        steps_taken = 0;
+        std::optional<Result> first;
+        auto keep_first = [&first](size_t starting_offset,
+                                   size_t ending_offset) {
+            if (!first) {
+                first = Result{starting_offset, ending_offset};
+            }
+        };
+        size_t str_idx = 0;
+        {
+            StatsTimer scan_timer(last_stats.scan_ns);
+            if (literal_engine()) {
+                LiteralSearcher::Cursor cursor;
+                regex->get_literal_searcher().next_matches(str, cursor,
+                                                           keep_first);
+                str_idx = cursor.pos;
+            } else {
+                while (!first && str_idx < str.size()) {
+                    str_idx = scan_position(str, str_idx, keep_first);
+                }
+                if (!first) {
+                    finish_position(main_lane, str.size(), keep_first);
+                }
+            }
+        }
+        if constexpr (STATS_ENABLED) {
+            last_stats.bytes_scanned = std::min(str_idx, str.size());
+            last_stats.matches_emitted = first ? 1 : 0;
+            total_stats += last_stats;
+        }
+        return first;
+    }
 
-            running_base_offset += line.length();
+    // only the leftmost longest matches that don't overlap, in order, each
+    // handed to sink as soon as no later match can beat it. these are the
+    // matches grep -o prints
+    template <typename Sink>
+    void match_leftmost_longest(std::string_view str, Sink &&sink) {
+        check_sink_capacity<Sink>(str.size());
+        leftmost.reset();
+        if (literal_engine()) {
+            counted_scan(
+                str,
+                [this, &sink](size_t starting_offset, size_t ending_offset) {
+                    leftmost(starting_offset, ending_offset);
+                    leftmost.settle(literal_frontier(ending_offset), sink);
+                },
+                [](size_t) {});
+        } else {
+            counted_scan(str, leftmost, [this, &sink](size_t next_idx) {
+                settle_step(next_idx, sink);
+            });
         }
+        leftmost.finish(sink);
+    }
 
-        return total_results;
+    // the same matches as a range that only scans as far as it's walked,
+    // see match_ranges.h. str has to outlive the walk
+    MatchView<Scanner> matches(std::string_view str) {
+        return {*this, str};
+    }
+
+    // the pieces of str between those matches, as a range
+    SplitView<Scanner> split(std::string_view str) {
+        return {*this, str};
+    }
+
+    // appends str to out with every leftmost longest match replaced, in
+    // the one pass that finds them, see Replacement for the syntax. out
+    // isn't cleared, so one buffer can collect many records
+    void replace_all(std::string_view str, Replacement const &replacement,
+                     std::string &out) {
+        replace_all(
+            str,
+            [&replacement](std::string_view match, std::string &out) {
+                replacement.append_to(out, match);
+            },
+            out);
+    }
+
+    void replace_all(std::string_view str, std::string_view replacement,
+                     std::string &out) {
+        replace_all(str, Replacement(replacement), out);
+    }
+
+    // same, but replacer(match, out) appends whatever replaces the match
+    template <typename F>
+        requires std::invocable<F &, std::string_view, std::string &>
+    void replace_all(std::string_view str, F &&replacer, std::string &out) {
+        out.reserve(out.size() + str.size());
+        size_t copied_up_to = 0;
+        match_leftmost_longest(str, [&](size_t starting_offset,
+                                        size_t ending_offset) {
+            out.append(str.substr(copied_up_to,
+                                  starting_offset - copied_up_to));
+            replacer(str.substr(starting_offset,
+                                ending_offset - starting_offset),
+                     out);
+            copied_up_to = ending_offset;
+        });
+        out.append(str.substr(copied_up_to));
+    }
+
+    std::string replace_all(std::string_view str,
+                            std::string_view replacement) {
+        std::string out;
+        replace_all(str, Replacement(replacement), out);
+        return out;
     }
 
-    friend std::ostream &operator<<(std::ostream &os, Matcher const &matcher);
+    // matches every record on its own, exactly as match() would, and appends
+    // the results to out in record order. nothing gets allocated per record
+    // once the scratch space has grown. with interleave > 1 that many
+    // records get stepped in lockstep so their transition lookups overlap;
+    // only the lazy dfa benefits, the other engines ignore it
+    void match_batch(std::span<std::string_view const> records,
+                     std::vector<BatchResult> &out, size_t interleave = 1) {
+        ++generation;
+        last_stats = {};
+        steps_taken = 0;
+        size_t const results_before = out.size();
+        {
+            StatsTimer scan_timer(last_stats.scan_ns);
+            if (regex->engine() == Engine::LAZY_DFA && interleave > 1) {
+                match_interleaved(records, out, interleave);
+            } else {
+                for (size_t record_idx = 0; record_idx < records.size();
+                     ++record_idx) {
+                    scan(records[record_idx],
+                         [&out, record_idx](size_t starting_offset,
+                                            size_t ending_offset) {
+                             out.push_back({record_idx, starting_offset,
+                                            ending_offset - starting_offset});
+                         });
+                }
+            }
+        }
+        if constexpr (STATS_ENABLED) {
+            for (auto const &record : records) {
+                last_stats.bytes_scanned += record.size();
+            }
+            last_stats.matches_emitted = out.size() - results_before;
+            total_stats += last_stats;
+        }
+    }
 
   private:
-    std::vector<Result> match_line(std::string_view str) {
-        std::vector<Result> to_return;
-        std::vector<State> next_active_states;
-
-        // used to merge sets
-        std::unordered_set<TransitionTable::State, TransitionTable::State::Hash>
-            temp_union;
-
-        // ok how to simulate bol?
-        // add a state first, then feed in BOL
-
-        // useful lambdas
-        auto add_new_active_matches = [&](size_t idx) {
-            // add a new active_match here
-            active_matches.push_back(
-                {{table.starting_states.begin(), table.starting_states.end()},
-                 idx,
-                 idx});
+    CompactTable const &table() const {
+        return regex->get_table();
+    }
+
+    bool literal_engine() const {
+        return regex->engine() == Engine::LITERAL ||
+               regex->engine() == Engine::LITERAL_ALTERNATION;
+    }
+
+    // literals get reported once they end, so the ones still to come can't
+    // start more than the longest literal before the last end
+    size_t literal_frontier(size_t ending_offset) const {
+        size_t longest = regex->get_literal_searcher().max_length();
+        return ending_offset - std::min(ending_offset, longest);
+    }
+
+    void lazy_begin(std::string_view str) {
+        ++generation;
+        last_stats = {};
+        steps_taken = 0;
+        leftmost.reset();
+        lazy.str = str;
+        lazy.str_idx = 0;
+        lazy.literal_cursor = {};
+        lazy.input_done = false;
+        lazy.ready.clear();
+        lazy.ready_head = 0;
+    }
+
+    // the next match of the lazy scan, stepping only until one is settled
+    std::optional<Result> lazy_next() {
+        auto queue = [this](size_t starting_offset, size_t ending_offset) {
+            lazy.ready.push_back({starting_offset, ending_offset});
         };
+        while (lazy.ready_head == lazy.ready.size()) {
+            if (lazy.input_done) {
+                return {};
+            }
+            lazy.ready.clear();
+            lazy.ready_head = 0;
+            lazy_advance(queue);
+        }
+        if constexpr (STATS_ENABLED) {
+            ++last_stats.matches_emitted;
+        }
+        return lazy.ready[lazy.ready_head++];
+    }
 
-        auto progress_states = [&](char char_to_match, size_t curr_idx,
-                                   bool update_accepting = true) {
-            for (auto &ac_st : active_matches) {
-                // clear out the scratch space
-                temp_union.clear();
-
-                // go through all the possible states of that active match
-                for (auto const &fa_state : ac_st.fa_states) {
-                    // get all the possible next states
-                    auto const &next_states =
-                        table.get_transition(fa_state, char_to_match);
-
-                    // append into temp union
-                    std::for_each(next_states.begin(), next_states.end(),
-                                  [&temp_union](auto const &next_state) {
-                                      temp_union.insert(next_state);
-                                  });
+    // one byte further, or one literal further
+    template <typename Sink>
+    void lazy_advance(Sink &&sink) {
+        std::string_view str = lazy.str;
+        if (literal_engine()) {
+            bool more = regex->get_literal_searcher().next_matches(
+                str, lazy.literal_cursor,
+                [this, &sink](size_t starting_offset, size_t ending_offset) {
+                    leftmost(starting_offset, ending_offset);
+                    leftmost.settle(literal_frontier(ending_offset), sink);
+                });
+            if (!more) {
+                lazy_finish(sink);
+            }
+            return;
+        }
+        if (lazy.str_idx < str.size()) {
+            lazy.str_idx = scan_position(str, lazy.str_idx, leftmost);
+            settle_step(lazy.str_idx, sink);
+            return;
+        }
+        finish_position(main_lane, str.size(), leftmost);
+        lazy_finish(sink);
+    }
+
+    template <typename Sink>
+    void lazy_finish(Sink &&sink) {
+        leftmost.finish(sink);
+        lazy.input_done = true;
+        if constexpr (STATS_ENABLED) {
+            last_stats.bytes_scanned = lazy.str.size();
+            total_stats += last_stats;
+        }
+    }
+
+    // the start of the oldest thread still alive, or past_idx if there is
+    // none. nothing reported from here on can start any earlier
+    static size_t oldest_start(ScanLane const &lane, size_t past_idx) {
+        size_t oldest = past_idx;
+        if (!lane.active_matches.empty()) {
+            oldest = std::min(oldest,
+                              lane.active_matches.front().starting_offset);
+        }
+        if (!lane.dfa_threads.empty()) {
+            oldest =
+                std::min(oldest, lane.dfa_threads.front().starting_offset);
+        }
+        return oldest;
+    }
+
+    // passes on whatever a leftmost longest scan has settled once it's at
+    // next_idx, then drops the starts that can't make it anymore. without
+    // that a long match drags every start inside it along, and every step
+    // reports each of them again
+    template <typename Sink>
+    void settle_step(size_t next_idx, Sink &&sink) {
+        leftmost.settle(oldest_start(main_lane, next_idx), sink);
+        drop_dead_starts(main_lane.active_matches);
+        drop_dead_starts(main_lane.dfa_threads);
+    }
+
+    // a thread goes once none of its starts are left. one that loses its
+    // oldest start moves on to the oldest of the rest, which can put it
+    // behind a younger thread, so then the threads get sorted again
+    template <typename Thread>
+    void drop_dead_starts(std::vector<Thread> &threads) {
+        bool reordered = false;
+        size_t kept = 0;
+        for (size_t idx = 0; idx < threads.size(); ++idx) {
+            auto &thread = threads[idx];
+            auto &merged = thread.merged_offsets;
+            std::erase_if(merged, [this](size_t start) {
+                return !leftmost.could_pass_on(start);
+            });
+            if (!leftmost.could_pass_on(thread.starting_offset)) {
+                if (merged.empty()) {
+                    if constexpr (std::is_same_v<Thread, State>) {
+                        spare_sets.push_back(std::move(thread.fa_states));
+                    }
+                    continue;
                 }
+                auto oldest = std::min_element(merged.begin(), merged.end());
+                thread.starting_offset = *oldest;
+                *oldest = merged.back();
+                merged.pop_back();
+                reordered = true;
+            }
+            if (kept != idx) {
+                threads[kept] = std::move(thread);
+            }
+            ++kept;
+        }
+        threads.erase(threads.begin() + (ptrdiff_t)kept, threads.end());
+        if (reordered) {
+            std::stable_sort(threads.begin(), threads.end(),
+                             [](Thread const &a, Thread const &b) {
+                                 return a.starting_offset < b.starting_offset;
+                             });
+        }
+    }
 
-                // if it's not empty, we update the match state list
-                if (!temp_union.empty()) {
-                    // overwrite the state list
-                    ac_st.fa_states.swap(temp_union);
-                    // see if any are matching
-
-                    // the latter condition avoids empty string matches
-                    if (table.is_accepting(ac_st.fa_states) &&
-                        curr_idx >= ac_st.starting_offset && update_accepting) {
-                        to_return.push_back(
-                            {ac_st.starting_offset, curr_idx + 1});
+    // scan plus the stats of one match call
+    template <typename F, typename G>
+    void counted_scan(std::string_view str, F &&emit, G &&after_step) {
+        ++generation;
+        last_stats = {};
+        steps_taken = 0;
+        size_t matches = 0;
+        {
+            StatsTimer scan_timer(last_stats.scan_ns);
+            scan(
+                str,
+                [&matches, &emit](size_t starting_offset,
+                                  size_t ending_offset) {
+                    if constexpr (STATS_ENABLED) {
+                        ++matches;
+                    }
+                    emit(starting_offset, ending_offset);
+                },
+                after_step);
+        }
+        if constexpr (STATS_ENABLED) {
+            last_stats.bytes_scanned = str.size();
+            last_stats.matches_emitted = matches;
+            total_stats += last_stats;
+        }
+    }
+
+    bool use_dfa() const {
+        return regex->engine() == Engine::LAZY_DFA && !dfa_fallback;
+    }
+
+    // anchored patterns only ever need the bol thread
+    bool spawn_threads() const {
+        return regex->engine() != Engine::ANCHORED_NFA;
+    }
+
+    static bool lane_idle(ScanLane const &lane) {
+        return lane.active_matches.empty() && lane.dfa_threads.empty();
+    }
+
+    // where the anchors sit. line by line every line gets scanned on its
+    // own, which disables multi-line matching, and the line retains its
+    // newline to help match against $
+    bool newlines_are_anchors() const {
+        return !options.whole_buffer || options.line_anchors;
+    }
+
+    bool at_line_start(std::string_view str, size_t idx) const {
+        if (idx == 0) {
+            return true;
+        }
+        return str[idx - 1] == '\n' && newlines_are_anchors();
+    }
+
+    bool at_line_end(std::string_view str, size_t idx) const {
+        if (str[idx] != '\n') {
+            // only the very end of the input can end a line without a newline
+            return idx + 1 == str.size();
+        }
+        return newlines_are_anchors() || idx + 1 == str.size();
+    }
+
+    // where the next thread could start once an anchored pattern has run out
+    size_t next_line_start(std::string_view str, size_t idx) const {
+        if (!newlines_are_anchors()) {
+            return str.size();
+        }
+        size_t next_newl = str.find('\n', idx);
+        return next_newl == std::string_view::npos ? str.size() : next_newl + 1;
+    }
+
+    static size_t count_lines(std::string_view str) {
+        size_t lines = (size_t)std::count(str.begin(), str.end(), '\n');
+        if (!str.empty() && str.back() != '\n') {
+            ++lines;
+        }
+        return lines;
+    }
+
+    // calls emit(starting_offset, ending_offset) for every match in str
+    template <typename F>
+    void scan(std::string_view str, F &&emit) {
+        scan(str, emit, [](size_t) {});
+    }
+
+    // and after_step(next_idx) every time the scan moves on
+    template <typename F, typename G>
+    void scan(std::string_view str, F &&emit, G &&after_step) {
+        switch (regex->engine()) {
+        case Engine::LITERAL:
+        case Engine::LITERAL_ALTERNATION:
+            scan_literals(str, emit);
+            return;
+        case Engine::NFA_SIMULATION:
+        case Engine::ANCHORED_NFA:
+        case Engine::LAZY_DFA:
+            break;
+        }
+
+        size_t str_idx = 0;
+        while (str_idx < str.size()) {
+            str_idx = scan_position(str, str_idx, emit);
+            after_step(str_idx);
+        }
+        finish_position(main_lane, str.size(), emit);
+    }
+
+    // steps the main lane over str[str_idx], or skips ahead to where the
+    // next thread could start. returns where to carry on
+    template <typename F>
+    size_t scan_position(std::string_view str, size_t str_idx, F &&emit) {
+        if (at_line_start(str, str_idx)) {
+            begin_line(main_lane, str_idx, emit);
+        }
+        if (!spawn_threads() && lane_idle(main_lane)) {
+            // nothing can start before the next line, skip ahead
+            return next_line_start(str, str_idx);
+        }
+        keep_cache_in_budget({&main_lane, 1});
+        step(main_lane, str[str_idx], str_idx, at_line_end(str, str_idx),
+             emit);
+        return str_idx + 1;
+    }
+
+    // literals can't contain a newline, so there is no need to split the
+    // input into lines first
+    template <typename F>
+    void scan_literals(std::string_view str, F &&emit) {
+        if constexpr (STATS_ENABLED) {
+            last_stats.lines += count_lines(str);
+        }
+        regex->get_literal_searcher().for_each_match(str, emit);
+    }
+
+    // steps up to `interleave` records at once, one byte each per round.
+    // every lane writes into its own buffer, flushed in record order
+    void match_interleaved(std::span<std::string_view const> records,
+                           std::vector<BatchResult> &out, size_t interleave) {
+        batch_lanes.resize(interleave);
+        batch_lane_results.resize(interleave);
+
+        for (size_t group_begin = 0; group_begin < records.size();
+             group_begin += interleave) {
+            size_t group_size =
+                std::min(interleave, records.size() - group_begin);
+            std::span<ScanLane> lanes{batch_lanes.data(), group_size};
+
+            batch_cursors.clear();
+            for (size_t lane_idx = 0; lane_idx < group_size; ++lane_idx) {
+                batch_cursors.push_back({group_begin + lane_idx, 0});
+                batch_lane_results[lane_idx].clear();
+                // a lane can still hold the threads of an earlier group or
+                // call, or of an empty record, with dfa states from before a
+                // cache reset since. the budget check would read them
+                clear_threads(lanes[lane_idx]);
+            }
+
+            bool any_running = true;
+            while (any_running) {
+                any_running = false;
+                keep_cache_in_budget(lanes);
+                for (size_t lane_idx = 0; lane_idx < group_size; ++lane_idx) {
+                    LaneCursor &cursor = batch_cursors[lane_idx];
+                    std::string_view record = records[cursor.record_idx];
+                    if (cursor.pos == record.size()) {
+                        continue;
+                    }
+                    any_running = true;
+
+                    auto &lane_results = batch_lane_results[lane_idx];
+                    auto emit = [&lane_results, &cursor](
+                                    size_t starting_offset,
+                                    size_t ending_offset) {
+                        lane_results.push_back(
+                            {cursor.record_idx, starting_offset,
+                             ending_offset - starting_offset});
+                    };
+
+                    ScanLane &lane = lanes[lane_idx];
+                    if (at_line_start(record, cursor.pos)) {
+                        begin_line(lane, cursor.pos, emit);
+                    }
+                    step(lane, record[cursor.pos], cursor.pos,
+                         at_line_end(record, cursor.pos), emit);
+                    ++cursor.pos;
+                    if (cursor.pos == record.size()) {
+                        finish_position(lane, cursor.pos, emit);
                     }
-                    // move this into next_active_state;
-                    next_active_states.push_back(std::move(ac_st));
                 }
             }
-            active_matches = std::move(next_active_states);
-            next_active_states.clear();
-        };
 
-        // feed in bol
-        add_new_active_matches(0);
-        progress_states(2, 0, false);
+            for (size_t lane_idx = 0; lane_idx < group_size; ++lane_idx) {
+                auto const &lane_results = batch_lane_results[lane_idx];
+                out.insert(out.end(), lane_results.begin(), lane_results.end());
+            }
+        }
+    }
 
-        // main iteration
-        for (size_t str_idx = 0; str_idx < str.length(); ++str_idx) {
-            add_new_active_matches(str_idx);
-            print_active_states();
-            progress_states(str[str_idx], str_idx);
+    void clear_threads(ScanLane &lane) {
+        for (auto &ac_st : lane.active_matches) {
+            spare_sets.push_back(std::move(ac_st.fa_states));
         }
-        print_active_states();
-        // feed in eol
-        progress_states(10, str.length() - 1);
+        lane.active_matches.clear();
+        lane.dfa_threads.clear();
+    }
 
-        return to_return;
+    template <typename F>
+    void begin_line(ScanLane &lane, size_t line_begin, F &&emit) {
+        if constexpr (STATS_ENABLED) {
+            ++last_stats.lines;
+        }
+        if (line_begin == 0 || !options.whole_buffer) {
+            // threads never carry over from the previous line, but the
+            // line's end can still finish a \b
+            finish_position(lane, line_begin, emit);
+            clear_threads(lane);
+        }
+        // whatever came before, a newline or nothing, is non-word
+        lane.prev_word = false;
+        spawn_bol_thread(lane, line_begin);
     }
 
-  private:
-    void print_active_states() const {
-        std::cout << "active matches: =============" << std::endl;
-        for (auto const &ac_st : active_matches) {
-            std::cout << "===============================" << std::endl;
-            std::cout << "starting_offset: " << ac_st.starting_offset << ";";
-            std::cout << "ending_offset: " << ac_st.ending_offset << ";";
-            std::cout << "ac states: " << std::endl;
+    bool has_boundaries() const {
+        return table().has_boundaries();
+    }
+
+    // takes the assertions that hold between the lane's last byte and one
+    // with next_word into closure, starting from fa_states. returns whether
+    // that got the thread to match when it didn't already
+    bool close_boundaries(ScanLane const &lane,
+                          std::unordered_set<CompactTable::StateId> const
+                              &fa_states,
+                          bool next_word) {
+        closure.assign(fa_states.begin(), fa_states.end());
+        char symbol = boundary_symbol(lane.prev_word, next_word);
+        return table().close_over(symbol, closure) &&
+               !is_accepting(fa_states) &&
+               std::any_of(closure.begin(), closure.end(),
+                           [this](CompactTable::StateId s) {
+                               return table().is_accepting(s);
+                           });
+    }
+
+    // the input ends at end_idx, or a line does and the threads are about
+    // to go. all that's left is whatever matches once the assertions that
+    // hold before a non-word byte are taken
+    template <typename F>
+    void finish_position(ScanLane &lane, size_t end_idx, F &&emit) {
+        if (!has_boundaries()) {
+            return;
+        }
+        if (use_dfa()) {
+            for (auto const &thread : lane.dfa_threads) {
+                if (dfa.accepts_at_end(table(), thread.dfa_state)) {
+                    emit_starts(thread, end_idx, emit);
+                }
+            }
+            return;
+        }
+        for (auto const &ac_st : lane.active_matches) {
+            if (close_boundaries(lane, ac_st.fa_states, false)) {
+                emit_starts(ac_st, end_idx, emit);
+            }
+        }
+    }
+
+    // a match ending at end_idx for every start the thread stands for,
+    // leaving out the empty one
+    template <typename Thread, typename F>
+    static void emit_starts(Thread const &thread, size_t end_idx, F &&emit) {
+        if (thread.starting_offset < end_idx) {
+            emit(thread.starting_offset, end_idx);
+        }
+        for (auto start : thread.merged_offsets) {
+            if (start < end_idx) {
+                emit(start, end_idx);
+            }
+        }
+    }
+
+    // line_end says whether a line ends at curr_idx, which the caller has
+    // to work out since it's the one that can see the input around it
+    template <typename F>
+    void step(ScanLane &lane, char char_to_match, size_t curr_idx,
+              bool line_end, F &&emit) {
+        step(lane, char_to_match, curr_idx, line_end, emit, emit);
+    }
+
+    // same, but the matches of a $ right before a newline go to
+    // emit_before_newline
+    template <typename F, typename G>
+    void step(ScanLane &lane, char char_to_match, size_t curr_idx,
+              bool line_end, F &&emit, G &&emit_before_newline) {
+        if (spawn_threads()) {
+            spawn_thread(lane, curr_idx);
+        }
+        charge_step(lane, curr_idx);
+        if (char_to_match == '\n' && line_end) {
+            // $ sits right before the newline, but the match keeps it
+            check_eol(lane, curr_idx, emit_before_newline);
+        }
+        progress_states(lane, char_to_match, curr_idx, emit);
+        lane.prev_word = is_word_char(char_to_match);
+        if (char_to_match != '\n' && line_end) {
+            check_eol(lane, curr_idx, emit);
+        }
+    }
+
+    // a compare per byte, so untrusted patterns fail fast instead of pinning
+    // a core. a throw leaves the lanes dirty, the next match call starts
+    // them over anyway
+    void charge_step(ScanLane const &lane, size_t curr_idx) {
+        size_t threads = lane.active_matches.size() + lane.dfa_threads.size();
+        if (threads > options.max_active_threads) {
+            throw LimitError(LimitError::Kind::ACTIVE_THREADS,
+                             options.max_active_threads, curr_idx);
+        }
+        steps_taken += threads;
+        if (steps_taken > options.max_steps) {
+            throw LimitError(LimitError::Kind::STEPS, options.max_steps,
+                             curr_idx);
+        }
+    }
+
+    void spawn_thread(ScanLane &lane, size_t idx) {
+        if constexpr (STATS_ENABLED) {
+            ++last_stats.threads_started;
+        }
+        if (use_dfa()) {
+            lane.dfa_threads.push_back(
+                {dfa.start_state(lane.prev_word), idx, {}});
+            return;
+        }
+        if (!start_set.empty()) {
+            lane.active_matches.push_back(
+                {reuse_set(start_set), idx, idx, {}});
+        }
+    }
+
+    // a copy of states in storage a finished thread left behind
+    std::unordered_set<CompactTable::StateId>
+    reuse_set(std::unordered_set<CompactTable::StateId> const &states) {
+        if (spare_sets.empty()) {
+            return states;
+        }
+        auto set = std::move(spare_sets.back());
+        spare_sets.pop_back();
+        set = states;
+        return set;
+    }
+
+    // how to simulate bol?
+    // a fresh thread that gets fed BOL before anything else. the other
+    // threads never see it, so it can happen in the middle of a buffer
+    void spawn_bol_thread(ScanLane &lane, size_t idx) {
+        if constexpr (STATS_ENABLED) {
+            ++last_stats.threads_started;
+        }
+        if (use_dfa()) {
+            uint32_t bol_state = LazyDFA::target(
+                dfa.next(table(), dfa.start_state(), BOL_SYMBOL));
+            if (bol_state != LazyDFA::DEAD) {
+                lane.dfa_threads.push_back({bol_state, idx, {}});
+            }
+            return;
+        }
+        if (!bol_start_set.empty()) {
+            lane.active_matches.push_back(
+                {reuse_set(bol_start_set), idx, idx, {}});
+        }
+    }
+
+    // $ always ends the pattern, so rather than feeding EOL to the threads
+    // it only gets checked: every thread that would accept after it is a
+    // match ending at curr_idx, and the threads themselves carry on
+    template <typename F>
+    void check_eol(ScanLane &lane, size_t curr_idx, F &&emit) {
+        if (use_dfa()) {
+            for (auto const &thread : lane.dfa_threads) {
+                uint32_t eol_state = LazyDFA::target(
+                    dfa.next(table(), thread.dfa_state, EOL_SYMBOL));
+                if (dfa.is_accepting(eol_state)) {
+                    emit_starts(thread, curr_idx + 1, emit);
+                }
+            }
+            return;
+        }
+        for (auto const &ac_st : lane.active_matches) {
+            // the line ends here, so the assertions before it see non-word
+            closure.assign(ac_st.fa_states.begin(), ac_st.fa_states.end());
+            if (has_boundaries()) {
+                table().close_over(boundary_symbol(lane.prev_word, false),
+                                   closure);
+            }
+            temp_union.clear();
+            for (auto fa_state : closure) {
+                auto next_states = table().get_transition(fa_state, EOL_SYMBOL);
+                temp_union.insert(next_states.begin(), next_states.end());
+            }
+            if (is_accepting(temp_union)) {
+                emit_starts(ac_st, curr_idx + 1, emit);
+            }
+        }
+    }
+
+    template <typename F>
+    void progress_states(ScanLane &lane, char char_to_match, size_t curr_idx,
+                         F &&emit) {
+        if (use_dfa()) {
+            progress_dfa_states(lane, char_to_match, curr_idx, emit);
+        } else {
+            progress_nfa_states(lane, char_to_match, curr_idx, emit);
+        }
+    }
+
+    template <typename F>
+    void progress_nfa_states(ScanLane &lane, char char_to_match,
+                             size_t curr_idx, F &&emit) {
+        bool boundaries = has_boundaries();
+        bool next_word = is_word_char(char_to_match);
+        for (auto &ac_st : lane.active_matches) {
+            if (boundaries) {
+                // the assertions between the last byte and this one
+                if (close_boundaries(lane, ac_st.fa_states, next_word)) {
+                    emit_starts(ac_st, curr_idx, emit);
+                }
+                ac_st.fa_states.insert(closure.begin(), closure.end());
+            }
+
+            // clear out the scratch space
+            temp_union.clear();
+
+            // go through all the possible states of that active match
             for (auto const &fa_state : ac_st.fa_states) {
-                std::cout << fa_state << std::endl;
+                // get all the possible next states
+                auto next_states =
+                    table().get_transition(fa_state, char_to_match);
+                if constexpr (STATS_ENABLED) {
+                    ++last_stats.states_touched;
+                    last_stats.transitions_taken += next_states.size();
+                }
+
+                // append into temp union
+                temp_union.insert(next_states.begin(), next_states.end());
+            }
+
+            // if it's not empty, we update the match state list
+            if (!temp_union.empty()) {
+                // overwrite the state list
+                ac_st.fa_states.swap(temp_union);
+                // see if any are matching
+
+                if (is_accepting(ac_st.fa_states)) {
+                    emit_starts(ac_st, curr_idx + 1, emit);
+                }
+                // move this into next_active_state;
+                next_active_states.push_back(std::move(ac_st));
+            } else {
+                // every state it was in is gone, dead ones included
+                spare_sets.push_back(std::move(ac_st.fa_states));
+            }
+        }
+        merge_nfa_threads(next_active_states);
+        lane.active_matches.swap(next_active_states);
+        next_active_states.clear();
+        if constexpr (STATS_ENABLED) {
+            last_stats.peak_active_threads = std::max(
+                last_stats.peak_active_threads, lane.active_matches.size());
+        }
+    }
+
+    // same walk, but every thread is a single dfa state
+    template <typename F>
+    void progress_dfa_states(ScanLane &lane, char char_to_match,
+                             size_t curr_idx, F &&emit) {
+        for (auto &thread : lane.dfa_threads) {
+            if constexpr (STATS_ENABLED) {
+                ++last_stats.states_touched;
+                ++last_stats.transitions_taken;
+            }
+            uint32_t transition =
+                dfa.next(table(), thread.dfa_state, char_to_match);
+            // a \b right before this byte
+            if (LazyDFA::matched_before(transition)) {
+                emit_starts(thread, curr_idx, emit);
+            }
+            uint32_t next_state = LazyDFA::target(transition);
+            if (next_state == LazyDFA::DEAD) {
+                continue;
+            }
+            if (dfa.is_accepting(next_state)) {
+                emit_starts(thread, curr_idx + 1, emit);
+            }
+            next_dfa_threads.push_back({next_state, thread.starting_offset,
+                                        std::move(thread.merged_offsets)});
+        }
+        merge_dfa_threads(next_dfa_threads);
+        lane.dfa_threads.swap(next_dfa_threads);
+        next_dfa_threads.clear();
+        if constexpr (STATS_ENABLED) {
+            last_stats.peak_active_threads = std::max(
+                last_stats.peak_active_threads, lane.dfa_threads.size());
+        }
+    }
+
+    // order doesn't matter, only that equal sets hash the same
+    static uint64_t hash_states(
+        std::unordered_set<CompactTable::StateId> const &states) {
+        uint64_t hash = states.size();
+        for (auto s : states) {
+            uint64_t mixed = (s + 1) * 0x9E3779B97F4A7C15ull;
+            hash += mixed ^ (mixed >> 29);
+        }
+        return hash;
+    }
+
+    template <typename Thread>
+    void absorb_thread(Thread &into, Thread &from) {
+        into.merged_offsets.push_back(from.starting_offset);
+        into.merged_offsets.insert(into.merged_offsets.end(),
+                                   from.merged_offsets.begin(),
+                                   from.merged_offsets.end());
+        if constexpr (STATS_ENABLED) {
+            ++last_stats.threads_merged;
+        }
+    }
+
+    // threads are oldest first, so the one every merge keeps is the oldest
+    void merge_nfa_threads(std::vector<State> &threads) {
+        if (threads.size() < 2) {
+            return;
+        }
+        nfa_merge_slots.clear();
+        size_t kept = 0;
+        for (size_t idx = 0; idx < threads.size(); ++idx) {
+            auto &thread = threads[idx];
+            uint64_t hash = hash_states(thread.fa_states);
+            auto [slot, inserted] = nfa_merge_slots.try_emplace(hash, kept);
+            // a collision between different sets just doesn't get merged
+            if (!inserted && threads[slot->second].fa_states ==
+                                 thread.fa_states) {
+                absorb_thread(threads[slot->second], thread);
+                spare_sets.push_back(std::move(thread.fa_states));
+                continue;
+            }
+            if (kept != idx) {
+                threads[kept] = std::move(thread);
+            }
+            ++kept;
+        }
+        threads.erase(threads.begin() + (ptrdiff_t)kept, threads.end());
+    }
+
+    void merge_dfa_threads(std::vector<DFAThread> &threads) {
+        if (threads.size() < 2) {
+            return;
+        }
+        ++merge_round;
+        if (dfa_merge_slots.size() < dfa.state_count()) {
+            dfa_merge_slots.resize(dfa.state_count());
+        }
+        size_t kept = 0;
+        for (size_t idx = 0; idx < threads.size(); ++idx) {
+            auto &thread = threads[idx];
+            auto &slot = dfa_merge_slots[thread.dfa_state];
+            if (slot.round == merge_round) {
+                absorb_thread(threads[slot.thread_idx], thread);
+                continue;
+            }
+            slot = {merge_round, kept};
+            if (kept != idx) {
+                threads[kept] = std::move(thread);
             }
-            std::cout << "===============================" << std::endl;
+            ++kept;
         }
-        std::cout << "===============================" << std::endl;
+        threads.erase(threads.begin() + (ptrdiff_t)kept, threads.end());
     }
+
+    // clears the dfa cache if it went over budget. if it's thrashing, every
+    // lane gets handed over to the nfa for good
+    void keep_cache_in_budget(std::span<ScanLane> lanes) {
+        if (!use_dfa() || !dfa.over_budget()) {
+            return;
+        }
+
+        live_dfa_states.clear();
+        for (auto const &lane : lanes) {
+            for (auto const &thread : lane.dfa_threads) {
+                live_dfa_states.push_back(thread.dfa_state);
+            }
+        }
+        bool keep_going = dfa.reset_cache(table(), live_dfa_states);
+        size_t live_idx = 0;
+        for (auto &lane : lanes) {
+            for (auto &thread : lane.dfa_threads) {
+                thread.dfa_state = live_dfa_states[live_idx++];
+            }
+        }
+        if (keep_going) {
+            return;
+        }
+
+        dfa_fallback = true;
+        for (auto &lane : lanes) {
+            lane.active_matches.clear();
+            for (auto const &thread : lane.dfa_threads) {
+                auto const &nfa_states = dfa.nfa_states(thread.dfa_state);
+                State ac_st;
+                ac_st.fa_states.insert(nfa_states.begin(), nfa_states.end());
+                ac_st.starting_offset = thread.starting_offset;
+                ac_st.ending_offset = thread.starting_offset;
+                ac_st.merged_offsets = thread.merged_offsets;
+                lane.active_matches.push_back(std::move(ac_st));
+            }
+            lane.dfa_threads.clear();
+        }
+    }
+
+    bool is_accepting(
+        std::unordered_set<CompactTable::StateId> const &set_of_states) const {
+        return std::any_of(
+            set_of_states.begin(), set_of_states.end(),
+            [this](CompactTable::StateId s) {
+                return table().is_accepting(s);
+            });
+    }
+};
+
+// a Scanner that compiles and owns its own pattern. to share a pattern
+// between threads, compile it once with compile_regex and give every thread
+// a Scanner over it instead
+class Matcher : public Scanner {
+  public:
+    explicit Matcher(std::string_view pattern, CompileOptions options = {},
+                     DFACacheConfig dfa_cache_config = {},
+                     ScanOptions scan_options = {})
+        : Scanner(compile_regex(pattern, options), dfa_cache_config,
+                  scan_options) {}
 };
 
-inline std::ostream &operator<<(std::ostream &os, Matcher const &matcher) {
-    os << matcher.table << std::endl;
+inline std::ostream &operator<<(std::ostream &os, Scanner const &scanner) {
+    os << *scanner.get_regex();
     return os;
 }
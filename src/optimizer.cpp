@@ -0,0 +1,330 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <span>
+#include <vector>
+
+namespace {
+
+// the positive sets a single char alternative can be merged into. a
+// negated set stays out, the chars it leaves out depend on icase
+bool is_char_class(Ast::Node const &node) {
+    using enum Ast::Kind;
+    return node.kind == CHAR || node.kind == DOT || node.kind == CLASS ||
+           (node.kind == SET && node.value == 0);
+}
+
+// what a * of a + of something is, and so on. only two +s or two ?s stay
+// what they were, every other pair is a *
+char combine_modifiers(char outer, char inner) {
+    return outer == inner && outer != '*' ? outer : '*';
+}
+
+class Optimizer {
+    Ast const &in;
+    Ast out;
+
+    Ast::Node const &node(Ast::NodeId id) const {
+        return out.node(id);
+    }
+
+    bool is_empty(Ast::NodeId id) const {
+        return node(id).kind == Ast::Kind::CONCAT && node(id).count == 0;
+    }
+
+    bool has_bol(Ast::NodeId id) const {
+        auto children = out.children(id);
+        return std::any_of(children.begin(), children.end(),
+                           [this](Ast::NodeId child) {
+                               return node(child).kind == Ast::Kind::BOL;
+                           });
+    }
+
+    bool same(Ast::NodeId a, Ast::NodeId b) const {
+        if (a == b) {
+            return true;
+        }
+        auto const &na = node(a);
+        auto const &nb = node(b);
+        if (na.kind != nb.kind || na.value != nb.value ||
+            na.count != nb.count) {
+            return false;
+        }
+        auto items_a = out.set_items(a);
+        auto items_b = out.set_items(b);
+        if (!std::equal(items_a.begin(), items_a.end(), items_b.begin())) {
+            return false;
+        }
+        auto children_a = out.children(a);
+        auto children_b = out.children(b);
+        for (size_t idx = 0; idx < children_a.size(); ++idx) {
+            if (!same(children_a[idx], children_b[idx])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // what id matches one after the other, itself unless it's a sequence
+    std::vector<Ast::NodeId> elements(Ast::NodeId id) const {
+        if (node(id).kind == Ast::Kind::CONCAT) {
+            auto children = out.children(id);
+            return {children.begin(), children.end()};
+        }
+        return {id};
+    }
+
+    // appends id to a sequence. a ^ anchors the sequence it's in, so a
+    // nested sequence with one only gets flattened if nothing but ^s come
+    // before it
+    void append_element(std::vector<Ast::NodeId> &sequence,
+                        Ast::NodeId id) const {
+        if (node(id).kind != Ast::Kind::CONCAT) {
+            sequence.push_back(id);
+            return;
+        }
+        bool only_bols = std::all_of(
+            sequence.begin(), sequence.end(), [this](Ast::NodeId element) {
+                return node(element).kind == Ast::Kind::BOL;
+            });
+        if (!only_bols && has_bol(id)) {
+            sequence.push_back(id);
+            return;
+        }
+        auto children = out.children(id);
+        sequence.insert(sequence.end(), children.begin(), children.end());
+    }
+
+    Ast::NodeId make_concat(std::span<Ast::NodeId const> sequence,
+                            Ast::Node const &origin) {
+        if (sequence.size() == 1) {
+            return sequence.front();
+        }
+        return out.add_parent(Ast::Kind::CONCAT, 0, sequence, origin.begin,
+                              origin.end);
+    }
+
+    Ast::NodeId make_repeat(char modifier, Ast::NodeId child,
+                            Ast::Node const &origin) {
+        if (is_empty(child)) {
+            // nothing, any number of times
+            return child;
+        }
+        if (node(child).kind == Ast::Kind::REPEAT) {
+            modifier = combine_modifiers(modifier, node(child).value);
+            child = out.children(child).front();
+        }
+        return out.add_parent(Ast::Kind::REPEAT, modifier, {&child, 1},
+                              origin.begin, origin.end);
+    }
+
+    Ast::NodeId optimize_concat(Ast::NodeId id) {
+        std::vector<Ast::NodeId> sequence;
+        for (auto child : in.children(id)) {
+            append_element(sequence, optimize_node(child));
+        }
+        // ^ anchors everything in its sequence wherever it is, so they can
+        // all go first. that way the prefixes of alternatives line up
+        std::stable_partition(
+            sequence.begin(), sequence.end(), [this](Ast::NodeId element) {
+                return node(element).kind == Ast::Kind::BOL;
+            });
+        return make_concat(sequence, in.node(id));
+    }
+
+    // merges every single char alternative into the first one
+    void merge_char_classes(std::vector<Ast::NodeId> &alternatives,
+                            Ast::Node const &origin) {
+        std::vector<Ast::SetItem> members;
+        size_t first_class = alternatives.size();
+        size_t classes = 0;
+        for (size_t idx = 0; idx < alternatives.size(); ++idx) {
+            auto const &alternative = node(alternatives[idx]);
+            if (!is_char_class(alternative)) {
+                continue;
+            }
+            first_class = std::min(first_class, idx);
+            ++classes;
+            switch (alternative.kind) {
+            case Ast::Kind::CHAR:
+                members.push_back({alternative.value, alternative.value, 0});
+                break;
+            case Ast::Kind::DOT:
+                // the same chars the table builder gives .
+                members.push_back({'!', '~', 0});
+                break;
+            case Ast::Kind::CLASS:
+                members.push_back({0, 0, alternative.value});
+                break;
+            default: {
+                auto items = out.set_items(alternatives[idx]);
+                members.insert(members.end(), items.begin(), items.end());
+            }
+            }
+        }
+        if (classes < 2) {
+            return;
+        }
+        auto merged = out.add_set(false, members, origin.begin, origin.end);
+        std::vector<Ast::NodeId> rest;
+        for (size_t idx = 0; idx < alternatives.size(); ++idx) {
+            if (idx == first_class) {
+                rest.push_back(merged);
+            } else if (!is_char_class(node(alternatives[idx]))) {
+                rest.push_back(alternatives[idx]);
+            }
+        }
+        alternatives = std::move(rest);
+    }
+
+    // groups the alternatives by their first (or last) element. every
+    // group of more than one becomes that element and an alternation of
+    // what's left of them
+    std::vector<Ast::NodeId> factor(std::vector<Ast::NodeId> alternatives,
+                                    bool suffix, Ast::Node const &origin) {
+        std::vector<std::vector<Ast::NodeId>> sequences;
+        for (auto alternative : alternatives) {
+            sequences.push_back(elements(alternative));
+        }
+        auto shared = [suffix](std::vector<Ast::NodeId> const &sequence) {
+            return suffix ? sequence.back() : sequence.front();
+        };
+
+        std::vector<Ast::NodeId> factored;
+        std::vector<bool> done(alternatives.size());
+        for (size_t idx = 0; idx < alternatives.size(); ++idx) {
+            if (done[idx]) {
+                continue;
+            }
+            Ast::NodeId element = shared(sequences[idx]);
+            // a sequence of nothing but ^s has no suffix to share
+            bool can_share = !suffix || node(element).kind != Ast::Kind::BOL;
+            std::vector<Ast::NodeId> remainders;
+            for (size_t other = idx; can_share && other < sequences.size();
+                 ++other) {
+                if (done[other] || !same(shared(sequences[other]), element)) {
+                    continue;
+                }
+                done[other] = true;
+                auto const &sequence = sequences[other];
+                std::span<Ast::NodeId const> remainder{sequence};
+                remainder = suffix ? remainder.first(remainder.size() - 1)
+                                   : remainder.subspan(1);
+                remainders.push_back(make_concat(remainder, origin));
+            }
+            if (remainders.size() < 2) {
+                factored.push_back(alternatives[idx]);
+                continue;
+            }
+
+            Ast::NodeId rest = optimize_alternatives(remainders, origin);
+            std::vector<Ast::NodeId> sequence;
+            if (suffix) {
+                append_element(sequence, rest);
+                sequence.push_back(element);
+            } else {
+                sequence.push_back(element);
+                append_element(sequence, rest);
+            }
+            factored.push_back(make_concat(sequence, origin));
+        }
+        return factored;
+    }
+
+    Ast::NodeId optimize_alternatives(std::vector<Ast::NodeId> alternatives,
+                                      Ast::Node const &origin) {
+        // every match gets reported either way, so a duplicate adds nothing
+        std::vector<Ast::NodeId> unique;
+        bool optional = false;
+        for (auto alternative : alternatives) {
+            if (is_empty(alternative)) {
+                optional = true;
+                continue;
+            }
+            if (std::none_of(unique.begin(), unique.end(),
+                             [this, alternative](Ast::NodeId kept) {
+                                 return same(kept, alternative);
+                             })) {
+                unique.push_back(alternative);
+            }
+        }
+        if (unique.empty()) {
+            return out.add_parent(Ast::Kind::CONCAT, 0, {}, origin.begin,
+                                  origin.end);
+        }
+        if (optional) {
+            return make_repeat('?', optimize_alternatives(unique, origin),
+                               origin);
+        }
+
+        merge_char_classes(unique, origin);
+        unique = factor(std::move(unique), false, origin);
+        unique = factor(std::move(unique), true, origin);
+        if (unique.size() == 1) {
+            return unique.front();
+        }
+        return out.add_parent(Ast::Kind::ALTERNATION, 0, unique,
+                              origin.begin, origin.end);
+    }
+
+    Ast::NodeId optimize_node(Ast::NodeId id) {
+        using enum Ast::Kind;
+        auto const &n = in.node(id);
+        switch (n.kind) {
+        case CHAR:
+        case DOT:
+        case CLASS:
+        case BOL:
+        case EOL:
+        case BOUNDARY:
+            return out.add_leaf(n.kind, n.value, n.begin, n.end);
+        case SET:
+            return out.add_set(n.value != 0, in.set_items(id), n.begin,
+                               n.end);
+        case GROUP: {
+            Ast::NodeId inner = optimize_node(in.children(id).front());
+            if (node(inner).kind == BOL) {
+                // (^) matches the BOL right where it is, a bare ^ would
+                // anchor the whole sequence
+                return out.add_parent(GROUP, 0, {&inner, 1}, n.begin, n.end);
+            }
+            return inner;
+        }
+        case REPEAT:
+            return make_repeat(n.value,
+                               optimize_node(in.children(id).front()), n);
+        case CONCAT:
+            return optimize_concat(id);
+        case ALTERNATION: {
+            std::vector<Ast::NodeId> alternatives;
+            for (auto child : in.children(id)) {
+                Ast::NodeId alternative = optimize_node(child);
+                if (node(alternative).kind == ALTERNATION) {
+                    auto nested = out.children(alternative);
+                    alternatives.insert(alternatives.end(), nested.begin(),
+                                        nested.end());
+                } else {
+                    alternatives.push_back(alternative);
+                }
+            }
+            return optimize_alternatives(std::move(alternatives), n);
+        }
+        }
+        return id;
+    }
+
+  public:
+    explicit Optimizer(Ast const &init_in) : in(init_in) {
+    }
+
+    Ast run() && {
+        out.set_root(optimize_node(in.root()));
+        return std::move(out);
+    }
+};
+
+} // namespace
+
+Ast optimize(Ast const &ast) {
+    return Optimizer(ast).run();
+}
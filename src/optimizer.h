@@ -0,0 +1,15 @@
+#pragma once
+
+#include "ast.h"
+
+// rewrites a parsed pattern into one that matches exactly the same, but
+// compiles into fewer states and fewer starting states:
+//   - groups go away, and nested sequences get flattened
+//   - nested quantifiers collapse, (a*)* and (a+)? both become a*
+//   - single char alternatives merge into one set, a|[bc]|\d is [abc\d]
+//   - alternatives share their common prefixes and suffixes, so
+//     error|errno|errors becomes err(or(s)?|no)
+//   - an empty alternative makes the rest optional, a(|b) is ab?
+// the literal searchers want the pattern as written, so this only runs for
+// the patterns that get a table
+Ast optimize(Ast const &ast);
@@ -1,197 +1,256 @@
 
 #include "parser.h"
-#include "Token.h"
 #include "matcher.h"
 
-#include <assert.h>
+#include <stdio.h>
 
-#include <optional>
-#include <stdexcept>
+#include <algorithm>
+#include <span>
+#include <string>
 #include <string_view>
 #include <vector>
 
-// returns std::nullopt if there are tokenizing issues..?
-std::optional<TokenStack> tokenize(std::string_view regex_string) {
-    using enum Token::NormalType;
-    using enum Token::SetType;
-    TokenStack token_stack;
-    for (size_t idx = 0; idx < regex_string.length(); ++idx) {
-
-        if (regex_string[idx] == '\\') {
-            // need to take the next char in faithfully
-            ++idx;
-            if (idx >= regex_string.length()) {
-                return {};
-            }
+namespace {
 
-            if (regex_string[idx] == 's' || regex_string[idx] == 'S' ||
-                regex_string[idx] == 'w' || regex_string[idx] == 'W' ||
-                regex_string[idx] == 'd' || regex_string[idx] == 'D') {
-                token_stack.push(
-                    {N_RESERV_SET, S_RESERV_SET, regex_string[idx]});
-            } else if (regex_string[idx] == 'b' || regex_string[idx] == 'B') {
-                token_stack.push({N_BOUNDARY, S_CHARACTER, regex_string[idx]});
-            } else {
-                token_stack.push({N_CHARACTER, S_CHARACTER, regex_string[idx]});
-            }
-            continue;
-        }
-
-        switch (regex_string[idx]) {
-        case '(':
-            token_stack.push({N_LPAREN, S_CHARACTER, regex_string[idx]});
-            break;
-        case ')':
-            token_stack.push({N_RPAREN, S_CHARACTER, regex_string[idx]});
-            break;
-        case '^':
-            if (idx > 0 && regex_string[idx - 1] == '[') {
-                token_stack.push({N_CHARACTER, S_NEG, regex_string[idx]});
-            } else {
-                token_stack.push({N_CHARACTER, S_CHARACTER, regex_string[idx]});
-            }
-            break;
-        case '$':
-            token_stack.push({N_EOL, S_CHARACTER, regex_string[idx]});
-            break;
-        case '.':
-            token_stack.push({N_RESERV_SET, S_CHARACTER, regex_string[idx]});
-            break;
-        case '|':
-            token_stack.push({N_OR, S_CHARACTER, regex_string[idx]});
-            break;
-        case '[':
-            token_stack.push({N_LSET, S_LSET, regex_string[idx]});
-            break;
-        case ']':
-            token_stack.push({N_RSET, S_RSET, regex_string[idx]});
-            break;
-        case '+':
-        case '*':
-        case '?':
-            token_stack.push({N_POST_MODIFIER, S_CHARACTER, regex_string[idx]});
-            break;
-        case '-':
-            token_stack.push({N_CHARACTER, S_RANGE, regex_string[idx]});
-            break;
-        default:
-            token_stack.push({N_CHARACTER, S_CHARACTER, regex_string[idx]});
-        }
-    }
-    token_stack.push({N_TERMINATOR, S_TERMINATOR, '\0'});
-    return token_stack;
+bool is_modifier(char c) {
+    return c == '*' || c == '+' || c == '?';
 }
 
-bool validate_set(TokenStack &token_stack) {
-    using enum Token::SetType;
+bool is_class_letter(char c) {
+    return c == 's' || c == 'S' || c == 'w' || c == 'W' || c == 'd' ||
+           c == 'D';
+}
 
-    // negation operations
-    token_stack.expect(S_NEG);
-    while (!token_stack.empty() && !token_stack.expect(S_RSET)) {
-        // rule: we always treat dash as a range operator
-        Token t = token_stack.pop();
+// the table has a row for every char below 127, and the ones the matcher
+// feeds itself (see is_virtual_symbol) can't come from a pattern either
+bool is_supported_byte(char c) {
+    return c >= 0 && c < 127 && !is_virtual_symbol(c);
+}
 
-        // ranges have to be surrounded by two members
-        if (t.set_type == S_RANGE) {
-            return false;
-        }
+// what an escaped char stands for when it isn't anything special
+char unescape(char c) {
+    // only useful when scanning whole buffers
+    return c == 'n' ? '\n' : c;
+}
 
-        if (t.set_type == S_RESERV_SET) {
-            continue;
-        }
+// recursive descent, straight from the pattern to the tree:
+//   alternation := sequence ('|' sequence)*
+//   sequence    := (assertion | atom modifier?)*
+//   atom        := char | '.' | '\' class | '[' set ']' | '(' alternation ')'
+class Parser {
+    std::string_view pattern;
+    size_t pos = 0;
+    Ast ast;
+    // the children of every sequence and alternation still being parsed,
+    // the innermost ones on top, so nesting never allocates
+    std::vector<Ast::NodeId> pending;
+    std::vector<Ast::SetItem> pending_items;
 
-        // the remaining case is that it's a member
-        assert(t.set_type == S_CHARACTER);
-        // peek to see if it's the range op
-        if (token_stack.expect(S_RANGE)) {
-            if (!(token_stack.expect(S_CHARACTER))) {
-                return false;
-            }
-        }
+    [[noreturn]] static void fail(std::string const &what, size_t offset) {
+        throw ParseError(what, offset);
     }
-    return true;
-}
 
-bool validate_helper(TokenStack &token_stack) {
-    if (token_stack.empty()) {
-        return true;
+    bool at_end() const {
+        return pos == pattern.size();
     }
 
-    using enum Token::NormalType;
-    if (token_stack.expect(N_RPAREN)) {
-        // defer back to the higher level of parsing
-        return true;
+    char peek() const {
+        return pattern[pos];
     }
 
-    // remove the BOL if it exists
-    token_stack.expect(N_BOL);
-
-    // pre-boundary values
-    while (token_stack.expect(N_BOUNDARY)) {
+    // the char after a \ at escape_pos
+    char escaped(size_t escape_pos) {
+        if (at_end()) {
+            fail("trailing \\", escape_pos);
+        }
+        return pattern[pos++];
+    }
+
+    // a single child stands for itself, an empty sequence is a CONCAT
+    // with no children
+    Ast::NodeId close(Ast::Kind kind, size_t begin, size_t base) {
+        std::span<Ast::NodeId const> children{pending.data() + base,
+                                              pending.size() - base};
+        Ast::NodeId id = children.size() == 1
+                             ? children.front()
+                             : ast.add_parent(kind, 0, children, begin, pos);
+        pending.resize(base);
+        return id;
+    }
+
+    Ast::NodeId parse_alternation() {
+        size_t begin = pos;
+        size_t base = pending.size();
+        pending.push_back(parse_sequence());
+        while (!at_end() && peek() == '|') {
+            ++pos;
+            pending.push_back(parse_sequence());
+        }
+        return close(Ast::Kind::ALTERNATION, begin, base);
     }
 
-    if (token_stack.expect(N_LPAREN)) {
-        // parse the sub expression
-        if (!validate_helper(token_stack)) {
-            return false;
+    Ast::NodeId parse_sequence() {
+        size_t begin = pos;
+        size_t base = pending.size();
+        while (!at_end() && peek() != '|' && peek() != ')') {
+            pending.push_back(parse_item());
         }
+        return close(Ast::Kind::CONCAT, begin, base);
+    }
 
-        // handle the post modifiers
-        token_stack.expect(N_POST_MODIFIER);
-
-        // post-boundary values
-        while (token_stack.expect(N_BOUNDARY)) {
+    Ast::NodeId parse_item() {
+        using enum Ast::Kind;
+        size_t begin = pos;
+        switch (peek()) {
+        case '^':
+            ++pos;
+            return ast.add_leaf(BOL, '^', begin, pos);
+        case '$':
+            ++pos;
+            return ast.add_leaf(EOL, '$', begin, pos);
+        case '*':
+        case '+':
+        case '?':
+            // also the second of two modifiers, and one after an assertion
+            fail("nothing to repeat", begin);
+        case ']':
+            fail("unmatched ]", begin);
+        case '\\':
+            if (pos + 1 < pattern.size() &&
+                (pattern[pos + 1] == 'b' || pattern[pos + 1] == 'B')) {
+                pos += 2;
+                return ast.add_leaf(BOUNDARY, pattern[pos - 1], begin, pos);
+            }
+            break;
+        default:
+            break;
         }
 
-        // remove the EOL
-        token_stack.expect(N_EOL);
-
-        return validate_helper(token_stack);
+        Ast::NodeId atom = parse_atom();
+        if (!at_end() && is_modifier(peek())) {
+            char modifier = pattern[pos++];
+            atom = ast.add_parent(REPEAT, modifier, {&atom, 1}, begin, pos);
+        }
+        return atom;
+    }
+
+    Ast::NodeId parse_atom() {
+        using enum Ast::Kind;
+        size_t begin = pos;
+        char c = pattern[pos++];
+        switch (c) {
+        case '(': {
+            Ast::NodeId inner = parse_alternation();
+            if (at_end()) {
+                fail("missing )", begin);
+            }
+            ++pos;
+            return ast.add_parent(GROUP, 0, {&inner, 1}, begin, pos);
+        }
+        case '[':
+            return parse_set(begin);
+        case '.':
+            return ast.add_leaf(DOT, c, begin, pos);
+        case '\\': {
+            char letter = escaped(begin);
+            if (is_class_letter(letter)) {
+                return ast.add_leaf(CLASS, letter, begin, pos);
+            }
+            return ast.add_leaf(CHAR, unescape(letter), begin, pos);
+        }
+        default:
+            return ast.add_leaf(CHAR, c, begin, pos);
+        }
     }
 
-    if (token_stack.expect(N_LSET)) {
-        if (!validate_set(token_stack)) {
-            return false;
+    // the [ at begin is already consumed. a - is always the range
+    // operator, so it needs a member on both sides, and a ^ only negates
+    // right after the [
+    Ast::NodeId parse_set(size_t begin) {
+        bool negated = !at_end() && peek() == '^';
+        if (negated) {
+            ++pos;
         }
-
-        token_stack.expect(N_POST_MODIFIER);
-        while (token_stack.expect(N_BOUNDARY)) {
+        pending_items.clear();
+        while (true) {
+            if (at_end()) {
+                fail("missing ]", begin);
+            }
+            size_t item_pos = pos;
+            char c = pattern[pos++];
+            if (c == ']') {
+                break;
+            }
+            if (c == '-') {
+                fail("range without a start", item_pos);
+            }
+            Ast::SetItem item;
+            if (c == '\\') {
+                char letter = escaped(item_pos);
+                if (is_class_letter(letter)) {
+                    item.reserved = letter;
+                    pending_items.push_back(item);
+                    continue;
+                }
+                c = unescape(letter);
+            }
+            item.first = item.last = c;
+
+            if (!at_end() && peek() == '-') {
+                size_t dash_pos = pos++;
+                if (at_end() || peek() == ']' || peek() == '-') {
+                    fail("range without an end", dash_pos);
+                }
+                size_t last_pos = pos;
+                char last = pattern[pos++];
+                if (last == '\\') {
+                    last = escaped(last_pos);
+                    if (is_class_letter(last)) {
+                        fail("range without an end", dash_pos);
+                    }
+                    last = unescape(last);
+                }
+                item.last = last;
+            }
+            pending_items.push_back(item);
         }
-        token_stack.expect(N_EOL);
-        return validate_helper(token_stack);
+        return ast.add_set(negated, pending_items, begin, pos);
     }
 
-    if (token_stack.expect(N_OR)) {
-        return validate_helper(token_stack);
+  public:
+    explicit Parser(std::string_view init_pattern) : pattern(init_pattern) {
     }
 
-    // remaining case, sequence of dots and chars
-    while (true) {
-        // expect a char or a set
-        if (!token_stack.expect(N_CHARACTER, N_RESERV_SET)) {
-            return false;
+    Ast run() && {
+        // checked up front, so nothing past here has to care. patterns can
+        // come from untrusted rules, and a byte the table has no row for
+        // would index past it
+        for (size_t idx = 0; idx < pattern.size(); ++idx) {
+            if (!is_supported_byte(pattern[idx])) {
+                char what[32];
+                snprintf(what, sizeof(what), "unsupported byte \\x%02x",
+                         (unsigned char)pattern[idx]);
+                fail(what, idx);
+            }
         }
-
-        // optionally a post modifier
-        token_stack.expect(N_POST_MODIFIER);
-
-        // then maybe a boundary (and there can be multiple)
-        while (token_stack.expect(N_BOUNDARY)) {
-            ;
+        Ast::NodeId root = parse_alternation();
+        if (!at_end()) {
+            // the only thing that stops the top level early
+            fail("unmatched )", pos);
         }
+        ast.set_root(root);
+        return std::move(ast);
     }
+};
 
-    // remove the EOL if it exists
-    token_stack.expect(N_EOL);
+} // namespace
 
-    return validate_helper(token_stack);
+Ast parse(std::string_view pattern) {
+    return Parser(pattern).run();
 }
 
-void compile_post_modifier(TableBuilder &table_builder,
-                           TokenStack &token_stack) {
-    // handle the post modifiers
-    using enum Token::NormalType;
-    switch (token_stack.peek().base_character) {
+void compile_post_modifier(TableBuilder &table_builder, char modifier) {
+    switch (modifier) {
     case '+':
         table_builder.plus_modify();
         break;
@@ -202,11 +261,8 @@ void compile_post_modifier(TableBuilder &table_builder,
         table_builder.question_modify();
         break;
     default:
-        return;
         break;
     }
-    // remove the token if we saw it
-    token_stack.expect(N_POST_MODIFIER);
 }
 
 std::vector<char> create_base_set() {
@@ -232,8 +288,9 @@ create_from_ranges(std::vector<std::pair<char, char>> ranges) {
             ran.second = temp;
         }
 
-        for (char c = ran.first; c <= ran.second; ++c) {
-            to_ret.push_back(c);
+        // an int, a char counter could never get past the end of ~
+        for (int c = ran.first; c <= ran.second; ++c) {
+            to_ret.push_back((char)c);
         }
     }
     return to_ret;
@@ -252,8 +309,6 @@ remove_from_base_set(std::vector<std::pair<char, char>> ranges) {
 
     char c = 32;
     for (auto ran : ranges) {
-        std::cerr << "ran.first: " << ran.first;
-        std::cerr << "ran.second: " << ran.second << std::endl;
         while (c < ran.first) {
             to_ret.push_back(c);
             ++c;
@@ -272,8 +327,8 @@ remove_from_base_set(std::vector<std::pair<char, char>> ranges) {
     return to_ret;
 };
 
-std::vector<char> compile_reserved_set(Token t) {
-    switch (t.base_character) {
+std::vector<char> compile_reserved_set(char letter) {
+    switch (letter) {
     case 's': {
         return {' ', '\t'};
         break;
@@ -300,171 +355,138 @@ std::vector<char> compile_reserved_set(Token t) {
     }
 }
 
-void compile_set(TableBuilder &table_builder, TokenStack &token_stack) {
-    using enum Token::SetType;
-
-    // negation operations
-    bool neg_mode = token_stack.expect(S_NEG);
-    std::vector<char> char_set;
-    while (!token_stack.empty() && token_stack.expect(S_RSET)) {
-        // rule: we always treat dash as a range operator
-        Token t = token_stack.pop();
-
-        // ranges have to be surrounded by two members
-        assert(t.set_type != S_RANGE);
-
-        if (t.set_type == S_RESERV_SET) {
-            auto set = compile_reserved_set(t);
-            char_set.insert(char_set.end(), set.begin(), set.end());
-            continue;
-        }
-
-        // the remaining case is that it's a member
-        assert(t.set_type == S_CHARACTER);
-        // peek to see if it's the range op
-        if (token_stack.expect(S_RANGE)) {
-            Token s = token_stack.pop();
-            assert(s.set_type == S_CHARACTER);
-            // now we create the range for t to s
-            auto set =
-                create_from_ranges({{t.base_character, s.base_character}});
-            char_set.insert(char_set.end(), set.begin(), set.end());
+// adds the other case of every letter, before any negation so that
+// [^a] keeps out both
+void fold_case(std::vector<char> &char_set) {
+    size_t original_size = char_set.size();
+    for (size_t idx = 0; idx < original_size; ++idx) {
+        char c = char_set[idx];
+        if (c >= 'a' && c <= 'z') {
+            char_set.push_back((char)(c - 'a' + 'A'));
+        } else if (c >= 'A' && c <= 'Z') {
+            char_set.push_back((char)(c - 'A' + 'a'));
         }
     }
+    std::sort(char_set.begin(), char_set.end());
+    char_set.erase(std::unique(char_set.begin(), char_set.end()),
+                   char_set.end());
+}
 
-    if (neg_mode) {
+void compile_chars(TableBuilder &table_builder, std::vector<char> char_set,
+                   bool negated, bool icase) {
+    if (icase) {
+        fold_case(char_set);
+    }
+    if (negated) {
         table_builder.add_char_neg_set_mode(char_set);
     } else {
         table_builder.add_char_set_mode(char_set);
     }
 }
 
-void compile_char(TableBuilder &table_builder, TokenStack &token_stack) {
-    // expect a char and optionally a post char modifier
-    // and optionally a word boundary
-    using enum Token::NormalType;
-
-    Token char_token = token_stack.pop();
+void compile_set(TableBuilder &table_builder, Ast const &ast, Ast::NodeId id,
+                 bool icase) {
     std::vector<char> char_set;
-    if (char_token.normal_type == N_CHARACTER) {
-        char_set.push_back(char_token.base_character);
-    } else {
-        assert(char_token.normal_type == N_RESERV_SET);
-        char_set = compile_reserved_set(char_token);
+    for (auto const &item : ast.set_items(id)) {
+        if (item.reserved != 0) {
+            auto set = compile_reserved_set(item.reserved);
+            char_set.insert(char_set.end(), set.begin(), set.end());
+        } else if (item.first == item.last) {
+            char_set.push_back(item.first);
+        } else {
+            auto set = create_from_ranges({{item.first, item.last}});
+            char_set.insert(char_set.end(), set.begin(), set.end());
+        }
     }
-    table_builder.add_char_set_mode(char_set);
+    compile_chars(table_builder, std::move(char_set),
+                  ast.node(id).value != 0, icase);
+}
 
-    switch (token_stack.peek().base_character) {
-    case '*':
-        table_builder.star_modify();
-        break;
-    case '+':
-        table_builder.plus_modify();
-        break;
-    case '?':
-        table_builder.question_modify();
-        break;
-    default:
-        break;
+// the builder only ever grows, so checking after every atom stops a pattern
+// long before its table gets out of hand
+void check_state_limit(TableBuilder const &table_builder, size_t max_states) {
+    if ((*table_builder).table.size() > max_states) {
+        throw LimitError(LimitError::Kind::STATES, max_states);
     }
-    // \b?
 }
 
-// should we just throw exception if it doesn't compile?
-void compile_helper(TableBuilder &table_builder, TokenStack &token_stack) {
-    if (token_stack.empty()) {
+// compiles the subtree at id into table_builder. the assertions modify
+// whatever the builder holds so far, everything else expects it to be fresh
+void compile_node(TableBuilder &table_builder, Ast const &ast, Ast::NodeId id,
+                  bool icase, size_t max_states) {
+    using enum Ast::Kind;
+    auto const &node = ast.node(id);
+    switch (node.kind) {
+    case CHAR:
+        compile_chars(table_builder, {node.value}, false, icase);
         return;
-    }
-
-    using enum Token::NormalType;
-    if (token_stack.peek().normal_type == RPAREN) {
+    case DOT:
+        table_builder.add_dot_char();
         return;
-    }
-    TableBuilder curr_table;
-
-    // if not start a new instance of table_builder
-    if (token_stack.expect(BOL)) {
-        // how should we handle bol? make a marker?
-        curr_table.bol_modify();
-    }
-
-    while (true) {
-        if (token_stack.expect(BOUNDARY)) {
-            curr_table.boundary_prefix_modify();
-        } else if (token_stack.expect(NON_BOUNDARY)) {
-            curr_table.non_boundary_prefix_modify();
-        } else {
-            break;
+    case CLASS:
+        compile_chars(table_builder, compile_reserved_set(node.value), false,
+                      icase);
+        return;
+    case SET:
+        compile_set(table_builder, ast, id, icase);
+        return;
+    case GROUP:
+        compile_node(table_builder, ast, ast.children(id).front(), icase,
+                     max_states);
+        return;
+    case REPEAT:
+        compile_node(table_builder, ast, ast.children(id).front(), icase,
+                     max_states);
+        compile_post_modifier(table_builder, node.value);
+        return;
+    case CONCAT:
+        for (auto child : ast.children(id)) {
+            if (Ast::is_assertion(ast.node(child).kind)) {
+                compile_node(table_builder, ast, child, icase, max_states);
+                continue;
+            }
+            // every atom gets a table of its own so the post modifier only
+            // applies to it
+            TableBuilder atom(table_builder.get_allocator());
+            compile_node(atom, ast, child, icase, max_states);
+            table_builder += atom;
+            check_state_limit(table_builder, max_states);
         }
-    }
-
-    if (token_stack.expect(LPAREN)) {
-        // parse the sub expression
-        compile_helper(curr_table, token_stack);
-        token_stack.expect(RPAREN);
-
-        // need to lookahead here, unfortunately.
-        compile_post_modifier(curr_table, token_stack);
-
-        table_builder += curr_table;
-        // now compile the rest of the pattern.
-        compile_helper(table_builder, token_stack);
         return;
-    }
-
-    if (token_stack.expect(LSET)) {
-        compile_set(curr_table, token_stack);
-        token_stack.expect(RSET);
-        compile_post_modifier(curr_table, token_stack);
-        table_builder += curr_table;
-        if (token_stack.expect(EOL)) {
-            table_builder.eol_modify();
+    case ALTERNATION: {
+        auto children = ast.children(id);
+        compile_node(table_builder, ast, children.front(), icase, max_states);
+        for (auto child : children.subspan(1)) {
+            TableBuilder rest(table_builder.get_allocator());
+            compile_node(rest, ast, child, icase, max_states);
+            table_builder |= rest;
+            check_state_limit(table_builder, max_states);
         }
-        compile_helper(table_builder, token_stack);
         return;
     }
-
-    if (token_stack.peek().normal_type == OR) {
-        token_stack.pop();
-        compile_helper(curr_table, token_stack);
-        table_builder |= curr_table;
+    case BOL:
+        table_builder.bol_modify();
         return;
-    }
-
-    while (true) {
-        Token::NormalType t_type = token_stack.peek().normal_type;
-        assert(t_type == CHARACTER || t_type == DOT ||
-               t_type == SET_WHITESPACE || t_type == SET_NON_WHITESPACE ||
-               t_type == SET_DIGIT || t_type == SET_NON_DIGIT ||
-               t_type == SET_WORD || t_type == SET_NON_WORD);
-
-        // get the char, the post modifier and optionally
-        // the boundary markers
-        compile_char(curr_table, token_stack);
-    }
-
-    // compile_post_modifier(curr_table, token_stack);
-    table_builder += curr_table;
-
-    if (token_stack.expect(EOL)) {
+    case EOL:
         table_builder.eol_modify();
+        return;
+    case BOUNDARY:
+        table_builder.boundary_modify(node.value == 'b');
+        return;
     }
-
-    compile_helper(table_builder, token_stack);
-    return;
 }
 
-TransitionTable compile(TokenStack &token_stack, bool reverse) {
+CompactTable compile(Ast const &ast, bool reverse, bool icase,
+                     size_t max_states) {
+    // every builder allocates out of this arena, and it all goes away in one
+    // shot once the table is compacted
+    std::pmr::monotonic_buffer_resource arena(64 * 1024);
+
     // start a table builder
-    TableBuilder table_builder;
-    compile_helper(table_builder, token_stack);
+    TableBuilder table_builder(&arena);
+    compile_node(table_builder, ast, ast.root(), icase, max_states);
     if (reverse) {
         table_builder.reverse_table();
     }
-    table_builder.shrink_to_fit();
-    return std::move(table_builder.get_table());
-}
-
-bool validate(TokenStack &token_stack) {
-    return validate_helper(token_stack) && token_stack.empty();
+    return CompactTable(*table_builder);
 }
@@ -1,23 +1,58 @@
 #pragma once
 
-#include "Token.h"
+#include "CompactTable.h"
 #include "TransitionTable.h"
+#include "ast.h"
+#include "resource_limits.h"
 
-#include <optional>
+#include <stddef.h>
+
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
 #include <string_view>
 #include <vector>
 
-std::optional<TokenStack> tokenize(std::string_view regex_string);
-bool validate(TokenStack &token_list);
-TransitionTable compile(TokenStack &token_stack, bool reverse);
+// thrown for a pattern that doesn't parse, offset says where in the
+// pattern it went wrong
+class ParseError : public std::runtime_error {
+    size_t pattern_offset;
 
+  public:
+    ParseError(std::string const &what, size_t offset)
+        : std::runtime_error(what + " at offset " + std::to_string(offset)),
+          pattern_offset(offset) {
+    }
+
+    size_t offset() const {
+        return pattern_offset;
+    }
+};
+
+// the whole pattern in one pass, throws ParseError if it isn't valid
+Ast parse(std::string_view pattern);
+// throws LimitError once the table needs more than max_states states
+CompactTable compile(Ast const &ast, bool reverse, bool icase,
+                     size_t max_states = NO_LIMIT);
+
+// every temporary builder shares the allocator of the builder that made it,
+// so one compilation never leaves its arena
 class TableBuilder {
     TransitionTable built_table;
 
   public:
+    using allocator_type = TransitionTable::allocator_type;
+
     TableBuilder() : built_table() {
     }
 
+    explicit TableBuilder(allocator_type alloc) : built_table(alloc) {
+    }
+
+    allocator_type get_allocator() const {
+        return built_table.get_allocator();
+    }
+
     TransitionTable const &operator*() const {
         return built_table;
     }
@@ -48,6 +83,19 @@ class TableBuilder {
             }
         }
 
+        // if this table can match the empty string, the other one can
+        // start right away too
+        if (std::any_of(built_table.starting_states.begin(),
+                        built_table.starting_states.end(),
+                        [this](TransitionTable::State const &s) {
+                            return built_table.is_accepting(s);
+                        })) {
+            built_table.starting_states.insert(
+                built_table.starting_states.end(),
+                (*other).starting_states.begin(),
+                (*other).starting_states.end());
+        }
+
         // append the tables
         built_table.table.insert((*other).table.begin(), (*other).table.end());
 
@@ -74,6 +122,11 @@ class TableBuilder {
     }
 
     void star_modify() {
+        plus_modify();
+        question_modify();
+    }
+
+    void plus_modify() {
         // you need to transition back to the start
         for (auto const &acc_state : built_table.accepting_states) {
             for (auto &row_pair : built_table.table) {
@@ -81,41 +134,50 @@ class TableBuilder {
                     acc_state, built_table.starting_states);
             }
         }
-
-        // set starting states as accepting states
-        built_table.accepting_states.insert(built_table.accepting_states.end(),
-                                            built_table.starting_states.begin(),
-                                            built_table.starting_states.end());
-    }
-
-    void plus_modify() {
-        // make a copy
-        TableBuilder temp = *this;
-        temp.star_modify();
-        *this += temp;
     }
 
     void bol_modify() {
-        TableBuilder temp;
-        // add the bol char = 2
-        temp.add_char(2);
+        TableBuilder temp(get_allocator());
+        temp.add_char(BOL_SYMBOL);
         temp += *this;
         // now swap this out for temp
         *this = std::move(temp);
     }
 
     void eol_modify() {
-        TableBuilder temp;
-        // add the bol char = 2
-        temp.add_char(10);
+        TableBuilder temp(get_allocator());
+        // not a newline, so a newline in the pattern still means one
+        temp.add_char(EOL_SYMBOL);
         *this += temp;
     }
 
+    // \b and \B, a transition on a symbol the matcher only feeds in
+    // where the assertion holds
+    void boundary_modify(bool word_boundary) {
+        add_char(word_boundary ? WORD_BOUNDARY_SYMBOL
+                               : NOT_WORD_BOUNDARY_SYMBOL);
+    }
+
     void question_modify() {
-        // set starting states as accepting states
-        built_table.accepting_states.insert(built_table.accepting_states.end(),
-                                            built_table.starting_states.begin(),
-                                            built_table.starting_states.end());
+        // the old starting states can be reached again through a loop back,
+        // accepting them would accept whatever led there too. a fresh one
+        // that moves wherever they did never gets reached
+        TransitionTable::State new_start;
+        TransitionTable::TransitionRow new_row(get_allocator());
+        for (auto const &s : built_table.starting_states) {
+            auto const &old_row = built_table.table.at(s);
+            for (size_t idx = 0; idx < new_row.row.size(); ++idx) {
+                new_row.row[idx].insert(new_row.row[idx].end(),
+                                        old_row.row[idx].begin(),
+                                        old_row.row[idx].end());
+            }
+        }
+        built_table.table.insert({new_start, std::move(new_row)});
+        built_table.starting_states.clear();
+        built_table.starting_states.push_back(new_start);
+
+        // set the starting state as accepting
+        built_table.accepting_states.push_back(new_start);
     }
 
     void add_char(char c) {
@@ -138,35 +200,36 @@ class TableBuilder {
     }
 
     void add_star_char(char c) {
-        TableBuilder char_table;
+        TableBuilder char_table(get_allocator());
         char_table.add_char(c);
         char_table.star_modify();
         *this += char_table;
     }
 
     void add_plus_char(char c) {
-        TableBuilder char_table;
+        TableBuilder char_table(get_allocator());
         char_table.add_char(c);
         char_table.plus_modify();
         *this += char_table;
     }
 
     void add_question_char(char c) {
-        TableBuilder char_table;
+        TableBuilder char_table(get_allocator());
         char_table.add_char(c);
         char_table.question_modify();
         *this += char_table;
     }
 
     void add_char_set_mode(std::vector<char> const &char_set) {
-        TableBuilder accum;
+        TableBuilder accum(get_allocator());
         // it only has one starting state
         auto &accum_starting_state = (*accum).starting_states.front();
         TransitionTable::State new_acc;
         for (char c : char_set) {
             (*accum).table.at(accum_starting_state).add_transition(new_acc, c);
         }
-        (*accum).table.insert({new_acc, TransitionTable::TransitionRow()});
+        (*accum).table.insert(
+            {new_acc, TransitionTable::TransitionRow(get_allocator())});
         (*accum).accepting_states.clear();
         (*accum).accepting_states.push_back(new_acc);
 
@@ -184,21 +247,21 @@ class TableBuilder {
     }
 
     void add_dot_star() {
-        TableBuilder tb;
+        TableBuilder tb(get_allocator());
         tb.add_dot_char();
         tb.star_modify();
         *this += tb;
     }
 
     void add_dot_plus() {
-        TableBuilder tb;
+        TableBuilder tb(get_allocator());
         tb.add_dot_char();
         tb.plus_modify();
         *this += tb;
     }
 
     void add_dot_question() {
-        TableBuilder tb;
+        TableBuilder tb(get_allocator());
         tb.add_dot_char();
         tb.question_modify();
         *this += tb;
@@ -217,13 +280,13 @@ class TableBuilder {
     }
 
     void reverse_table() {
-        std::unordered_map<TransitionTable::State,
-                           TransitionTable::TransitionRow,
-                           TransitionTable::State::Hash>
-            new_table;
+        std::pmr::unordered_map<TransitionTable::State,
+                                TransitionTable::TransitionRow,
+                                TransitionTable::State::Hash>
+            new_table(get_allocator());
         for (auto const &state_row : built_table.table) {
-            new_table.insert(
-                {state_row.first, TransitionTable::TransitionRow{}});
+            new_table.insert({state_row.first,
+                              TransitionTable::TransitionRow(get_allocator())});
         }
 
         for (auto const &state_row : built_table.table) {
@@ -238,14 +301,4 @@ class TableBuilder {
         // swap the starting and ending tables
         built_table.starting_states.swap(built_table.accepting_states);
     }
-
-    void shrink_to_fit() {
-        for (auto &transition_row_pair : built_table.table) {
-            TransitionTable::TransitionRow &transition_row =
-                transition_row_pair.second;
-            for (size_t idx = 0; idx < 128; ++idx) {
-                transition_row[(char)idx].shrink_to_fit();
-            }
-        }
-    }
 };
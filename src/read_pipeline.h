@@ -0,0 +1,409 @@
+#pragma once
+
+#include "uring.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// reads an fd through a ring of buffers that get filled ahead of the scan,
+// so reading buffer n + 1 overlaps scanning buffer n. the reads go through
+// io_uring, or through a thread of their own where that isn't there. a
+// source like a decompressor can stand in for the fd, and then runs on
+// that thread. next_lines() only ever hands out whole lines, so a line
+// oriented scan can run over every piece as if it were all there is, only
+// the lines that straddle two buffers get copied
+class ReadPipeline {
+  public:
+    static constexpr size_t BUFFER_SIZE = 256 << 10;
+    // buffers in the ring, so how far the reads can run ahead
+    static constexpr size_t DEPTH = 4;
+
+  private:
+    struct Slot {
+        std::unique_ptr<char[]> data{new char[BUFFER_SIZE]};
+        // where in the file it was read from, if the file has positions
+        uint64_t offset = 0;
+        // filled and not handed back yet. 0 bytes means the input is over
+        bool ready = false;
+        bool in_flight = false;
+        size_t size = 0;
+        int error = 0;
+        // what the source threw
+        std::exception_ptr failure;
+    };
+
+    int fd;
+    std::string label;
+    std::array<Slot, DEPTH> slots;
+    // reads queued and slots taken by the scan so far. slot n % DEPTH
+    // holds read n
+    size_t reads_queued = 0;
+    size_t slots_taken = 0;
+
+    // regular files get read at offsets, every free buffer at once, up to
+    // the size they had when opened. anything else can only be read where
+    // it's at, one read at a time, until a read comes back empty
+    bool positioned = false;
+    uint64_t start_offset = 0;
+    uint64_t next_offset = 0;
+    uint64_t end_offset = 0;
+    bool reads_done = false;
+
+    std::optional<Uring> uring;
+    // a read went through, so io_uring can be trusted with the rest
+    bool uring_works = false;
+
+    // the fallback, and the thread a source runs on
+    std::function<size_t(char *, size_t)> source;
+    std::thread reader;
+    std::mutex lock;
+    std::condition_variable changed;
+    bool stopping = false;
+
+    // the scan side
+    Slot *current = nullptr;
+    size_t current_pos = 0;
+    // the start of a line that didn't end in the buffer it began in
+    std::string carry;
+    // carry with the rest of its line, handed out on its own
+    std::string joined;
+    bool input_done = false;
+
+    [[noreturn]] void fail(int error) const {
+        throw std::runtime_error(label + ": " + strerror(error));
+    }
+
+    size_t in_flight() const {
+        return (size_t)std::count_if(
+            slots.begin(), slots.end(),
+            [](Slot const &slot) { return slot.in_flight; });
+    }
+
+    // how much of the file read n covers, 0 past the end
+    size_t planned_size(uint64_t offset) const {
+        if (offset >= end_offset) {
+            return 0;
+        }
+        return (size_t)std::min<uint64_t>(BUFFER_SIZE, end_offset - offset);
+    }
+
+    // queues reads into every free buffer it may
+    void queue_reads() {
+        while (!reads_done && reads_queued - slots_taken < DEPTH &&
+               (positioned || in_flight() == 0)) {
+            Slot &slot = slots[reads_queued % DEPTH];
+            slot.offset = next_offset;
+            slot.in_flight = true;
+            size_t len = BUFFER_SIZE;
+            if (positioned) {
+                len = planned_size(next_offset);
+                // a final empty read marks the end like it does for pipes
+                reads_done = len == 0;
+                next_offset += len;
+            }
+            uring->read(fd, slot.data.get(), (unsigned)len,
+                        positioned ? slot.offset : (uint64_t)-1,
+                        reads_queued % DEPTH);
+            ++reads_queued;
+        }
+    }
+
+    // a read of a regular file can come back short, the rest gets read
+    // right away so the next buffer still starts where it should
+    void fill_up(Slot &slot) {
+        size_t wanted = planned_size(slot.offset);
+        while (slot.error == 0 && slot.size < wanted) {
+            ssize_t got = pread(fd, slot.data.get() + slot.size,
+                                wanted - slot.size,
+                                (off_t)(slot.offset + slot.size));
+            if (got < 0 && errno != EINTR) {
+                slot.error = errno;
+            } else if (got == 0) {
+                break;
+            } else if (got > 0) {
+                slot.size += (size_t)got;
+            }
+        }
+    }
+
+    // what the constructor starts when io_uring isn't there
+    void start_thread() {
+        if (positioned) {
+            // the thread reads from the current position
+            lseek(fd, (off_t)start_offset, SEEK_SET);
+        }
+        reader = std::thread([this] { read_loop(); });
+    }
+
+    // a filter can refuse the reads even where the probe says they work,
+    // and then every one of them fails with EINVAL. nothing got handed out
+    // yet, so the thread can start over from the beginning
+    Slot &fall_back_to_thread() {
+        while (in_flight() > 0) {
+            slots[uring->wait().user_data].in_flight = false;
+        }
+        uring.reset();
+        for (auto &slot : slots) {
+            slot.ready = false;
+            slot.size = 0;
+            slot.error = 0;
+        }
+        reads_queued = 0;
+        start_thread();
+        return take_thread_slot();
+    }
+
+    Slot &take_uring_slot() {
+        Slot &slot = slots[slots_taken % DEPTH];
+        while (!slot.ready) {
+            auto completion = uring->wait();
+            if (!uring_works && completion.result == -EINVAL) {
+                slots[completion.user_data].in_flight = false;
+                return fall_back_to_thread();
+            }
+            uring_works = true;
+            Slot &done = slots[completion.user_data];
+            done.in_flight = false;
+            done.ready = true;
+            done.size = completion.result > 0 ? (size_t)completion.result : 0;
+            done.error = completion.result < 0 ? -completion.result : 0;
+            if (positioned) {
+                fill_up(done);
+            } else if (done.size == 0) {
+                reads_done = true;
+            }
+            // a pipe gets its next read going before this one is scanned
+            queue_reads();
+        }
+        return slot;
+    }
+
+    // one read() of the fd, 0 at the end or on an error
+    size_t read_some(char *buf, size_t len, int &error) {
+        while (true) {
+            ssize_t got = ::read(fd, buf, len);
+            if (got >= 0) {
+                return (size_t)got;
+            }
+            if (errno != EINTR) {
+                error = errno;
+                return 0;
+            }
+        }
+    }
+
+    // fills the ring in order for as long as the scan hands buffers back
+    void read_loop() {
+        for (size_t n = 0;; ++n) {
+            Slot &slot = slots[n % DEPTH];
+            {
+                std::unique_lock guard(lock);
+                changed.wait(guard,
+                             [this, &slot] { return stopping || !slot.ready; });
+                if (stopping) {
+                    return;
+                }
+            }
+            size_t size = 0;
+            int error = 0;
+            std::exception_ptr failure;
+            try {
+                while (error == 0 && size < BUFFER_SIZE) {
+                    size_t got = source
+                                     ? source(slot.data.get() + size,
+                                              BUFFER_SIZE - size)
+                                     : read_some(slot.data.get() + size,
+                                                 BUFFER_SIZE - size, error);
+                    if (got == 0) {
+                        break;
+                    }
+                    size += got;
+                }
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            {
+                std::lock_guard guard(lock);
+                slot.size = size;
+                slot.error = error;
+                slot.failure = failure;
+                slot.ready = true;
+            }
+            changed.notify_all();
+            if (size == 0 || error != 0 || failure) {
+                return;
+            }
+        }
+    }
+
+    Slot &take_thread_slot() {
+        Slot &slot = slots[slots_taken % DEPTH];
+        std::unique_lock guard(lock);
+        changed.wait(guard, [&slot] { return slot.ready; });
+        return slot;
+    }
+
+    // the next filled buffer, nullptr once the input is over
+    Slot *take_slot() {
+        Slot &slot = uring ? take_uring_slot() : take_thread_slot();
+        if (slot.failure) {
+            std::rethrow_exception(slot.failure);
+        }
+        if (slot.error != 0) {
+            fail(slot.error);
+        }
+        if (slot.size == 0) {
+            return nullptr;
+        }
+        ++slots_taken;
+        return &slot;
+    }
+
+    void give_back(Slot &slot) {
+        if (uring) {
+            slot.ready = false;
+            queue_reads();
+            return;
+        }
+        {
+            std::lock_guard guard(lock);
+            slot.ready = false;
+        }
+        changed.notify_all();
+    }
+
+  public:
+    // starts reading fd right away. fd stays open and has to outlive this.
+    // prefer_uring is there to test the fallback
+    ReadPipeline(int init_fd, std::string init_label, bool prefer_uring = true)
+        : fd(init_fd), label(std::move(init_label)) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            fail(errno);
+        }
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        if (S_ISREG(st.st_mode) && start >= 0) {
+            positioned = true;
+            start_offset = (uint64_t)start;
+            next_offset = start_offset;
+            end_offset = std::max(next_offset, (uint64_t)st.st_size);
+        }
+
+        if (prefer_uring) {
+            try {
+                uring.emplace((unsigned)DEPTH);
+            } catch (std::runtime_error const &) {
+                // the thread it is
+            }
+        }
+        if (uring) {
+            queue_reads();
+        } else {
+            start_thread();
+        }
+    }
+
+    // fills the buffers from whatever source writes into the buffer it's
+    // given, at most the size it's given, returning how much it wrote and
+    // 0 once there's nothing more. what it throws comes out of next_lines()
+    ReadPipeline(std::string init_label,
+                 std::function<size_t(char *, size_t)> init_source)
+        : fd(-1), label(std::move(init_label)),
+          source(std::move(init_source)) {
+        reader = std::thread([this] { read_loop(); });
+    }
+
+    ReadPipeline(ReadPipeline const &) = delete;
+    ReadPipeline &operator=(ReadPipeline const &) = delete;
+
+    // waits for the reads still going, they write into the buffers. on a
+    // pipe that means waiting for the writer if the scan stopped early
+    ~ReadPipeline() {
+        if (uring) {
+            while (in_flight() > 0) {
+                auto completion = uring->wait();
+                slots[completion.user_data].in_flight = false;
+            }
+            return;
+        }
+        {
+            std::lock_guard guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        reader.join();
+    }
+
+    bool uses_uring() const {
+        return uring.has_value();
+    }
+
+    // the next run of whole lines, the last one without a newline if the
+    // input doesn't end in one. empty once the input is over, otherwise
+    // valid until the next call. throws std::runtime_error on read errors
+    std::string_view next_lines() {
+        while (!input_done) {
+            if (current == nullptr) {
+                current = take_slot();
+                current_pos = 0;
+                if (current == nullptr) {
+                    input_done = true;
+                    break;
+                }
+            }
+            std::string_view data{current->data.get() + current_pos,
+                                  current->size - current_pos};
+            if (data.empty()) {
+                give_back(*current);
+                current = nullptr;
+                continue;
+            }
+
+            if (!carry.empty()) {
+                size_t newline = data.find('\n');
+                if (newline == std::string_view::npos) {
+                    carry.append(data);
+                    current_pos = current->size;
+                    continue;
+                }
+                joined.swap(carry);
+                carry.clear();
+                joined.append(data.substr(0, newline + 1));
+                current_pos += newline + 1;
+                return joined;
+            }
+
+            size_t last_newline = data.rfind('\n');
+            if (last_newline == std::string_view::npos) {
+                carry.assign(data);
+                current_pos = current->size;
+                continue;
+            }
+            carry.assign(data.substr(last_newline + 1));
+            current_pos = current->size;
+            // the buffer goes back on the next call, after the scan
+            return data.substr(0, last_newline + 1);
+        }
+        joined.swap(carry);
+        carry.clear();
+        return joined;
+    }
+};
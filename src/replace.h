@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// what replace_all puts in place of every match, parsed once. $0 stands for
+// the whole match and $$ for a plain $, a $ before anything else is taken as
+// is. $1 to $9 are refused for now, patterns don't have groups to refer to
+class Replacement {
+    // the replacement with the $0s taken out
+    std::string text;
+    // where in text the match goes, in order
+    std::vector<size_t> match_at;
+
+  public:
+    // implicit, so a plain string does wherever a Replacement goes
+    Replacement(std::string_view replacement) {
+        text.reserve(replacement.size());
+        for (size_t idx = 0; idx < replacement.size(); ++idx) {
+            char c = replacement[idx];
+            char next = idx + 1 < replacement.size() ? replacement[idx + 1]
+                                                      : '\0';
+            if (c != '$' || (next != '$' && (next < '0' || next > '9'))) {
+                text.push_back(c);
+                continue;
+            }
+            ++idx;
+            if (next == '$') {
+                text.push_back('$');
+            } else if (next == '0') {
+                match_at.push_back(text.size());
+            } else {
+                throw std::runtime_error(
+                    std::string("replacement refers to group ") + next +
+                    ", patterns have no groups");
+            }
+        }
+    }
+
+    // appends what replaces match to out
+    void append_to(std::string &out, std::string_view match) const {
+        size_t pos = 0;
+        for (size_t at : match_at) {
+            out.append(text, pos, at - pos);
+            out.append(match);
+            pos = at;
+        }
+        out.append(text, pos);
+    }
+};
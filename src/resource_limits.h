@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+// the default for every limit
+inline constexpr size_t NO_LIMIT = std::numeric_limits<size_t>::max();
+
+// thrown when a pattern or an input needs more than it was allowed, so
+// rules from untrusted sources can't pin a core or eat all the memory.
+// it's a runtime_error like every other failure, callers that care about
+// which limit tripped catch this one first
+class LimitError : public std::runtime_error {
+  public:
+    enum class Kind {
+        // nfa states while compiling
+        STATES,
+        // threads alive at once in a scan
+        ACTIVE_THREADS,
+        // threads stepped over one match call
+        STEPS,
+    };
+
+  private:
+    Kind limit_kind;
+    size_t limit_value;
+    size_t input_offset;
+
+    static std::string describe(Kind kind, size_t limit, size_t offset) {
+        switch (kind) {
+        case Kind::STATES:
+            return "pattern needs more than " + std::to_string(limit) +
+                   " states";
+        case Kind::ACTIVE_THREADS:
+            return "more than " + std::to_string(limit) +
+                   " active threads at offset " + std::to_string(offset);
+        case Kind::STEPS:
+            return "more than " + std::to_string(limit) +
+                   " steps by offset " + std::to_string(offset);
+        }
+        return "limit exceeded";
+    }
+
+  public:
+    LimitError(Kind kind, size_t limit, size_t offset = 0)
+        : std::runtime_error(describe(kind, limit, offset)), limit_kind(kind),
+          limit_value(limit), input_offset(offset) {
+    }
+
+    Kind kind() const {
+        return limit_kind;
+    }
+
+    size_t limit() const {
+        return limit_value;
+    }
+
+    // where in the input the scan gave up, 0 for compile time limits
+    size_t offset() const {
+        return input_offset;
+    }
+};
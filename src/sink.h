@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// a match as [starting_offset, ending_offset) into the input
+template <typename Offset>
+struct BasicResult {
+    Offset starting_offset;
+    Offset ending_offset;
+};
+
+using Result = BasicResult<size_t>;
+// half the size, enough for any input under 4 GiB
+using CompactResult = BasicResult<uint32_t>;
+
+// a sink is anything callable as sink(starting_offset, ending_offset), which
+// the matchers call once per match as they find it. a lambda is the simplest
+// one, the ones below cover the common cases without a vector<Result> in
+// between
+
+// only counts, nothing gets stored
+struct CountSink {
+    size_t count = 0;
+
+    void operator()(size_t, size_t) {
+        ++count;
+    }
+};
+
+// appends to a vector. with the default 32 bit offsets every match costs
+// half as much to store and copy as a Result
+template <typename Offset = uint32_t>
+struct VectorSink {
+    static constexpr size_t max_input_size =
+        std::numeric_limits<Offset>::max();
+
+    std::vector<BasicResult<Offset>> results;
+
+    void operator()(size_t starting_offset, size_t ending_offset) {
+        results.push_back({(Offset)starting_offset, (Offset)ending_offset});
+    }
+};
+
+// keeps the last `capacity` matches in storage allocated once up front, so
+// a scan never allocates however many matches it finds. older matches get
+// overwritten and only show up in dropped()
+template <typename Offset = uint32_t>
+class RingBufferSink {
+    std::vector<BasicResult<Offset>> buffer;
+    // where the next match goes
+    size_t next = 0;
+    size_t seen = 0;
+
+  public:
+    static constexpr size_t max_input_size =
+        std::numeric_limits<Offset>::max();
+
+    explicit RingBufferSink(size_t capacity) : buffer(capacity) {
+        if (capacity == 0) {
+            throw std::runtime_error("ring buffer sink needs some capacity");
+        }
+    }
+
+    void operator()(size_t starting_offset, size_t ending_offset) {
+        buffer[next] = {(Offset)starting_offset, (Offset)ending_offset};
+        next = next + 1 == buffer.size() ? 0 : next + 1;
+        ++seen;
+    }
+
+    size_t capacity() const {
+        return buffer.size();
+    }
+
+    // how many matches are held right now
+    size_t size() const {
+        return std::min(seen, buffer.size());
+    }
+
+    // every match ever seen, held or not
+    size_t total() const {
+        return seen;
+    }
+
+    size_t dropped() const {
+        return seen - size();
+    }
+
+    // oldest first
+    BasicResult<Offset> const &operator[](size_t idx) const {
+        size_t oldest = seen > buffer.size() ? next : 0;
+        size_t pos = oldest + idx;
+        return buffer[pos >= buffer.size() ? pos - buffer.size() : pos];
+    }
+
+    void clear() {
+        next = 0;
+        seen = 0;
+    }
+};
+
+// picks the leftmost longest matches that don't overlap, the ones grep -o
+// prints and a replace replaces, out of every (start, end) pair the
+// matchers report. it gets fed like any sink, but a match can only be
+// passed on once nothing reported later could start at or before it, which
+// whoever feeds it says through settle(). the candidates go in storage that
+// sticks around, reset() starts over without freeing it
+class LeftmostLongest {
+    // by start, every start with the longest end seen for it. the ones
+    // before head are passed on already
+    std::vector<Result> pending;
+    size_t head = 0;
+    // where the last match passed on ended
+    size_t cursor = 0;
+    // whether the candidate at head is the oldest start left, see settle()
+    bool head_claimed = false;
+
+  public:
+    void reset() {
+        pending.clear();
+        head = 0;
+        cursor = 0;
+        head_claimed = false;
+    }
+
+    // whether a match starting at start could still get passed on. none
+    // before the cursor can, and none inside a claimed candidate either:
+    // nothing can beat that one anymore, and it only gets longer. whoever
+    // feeds this can drop the threads of such starts
+    bool could_pass_on(size_t start) const {
+        if (start < cursor) {
+            return false;
+        }
+        if (!head_claimed) {
+            return true;
+        }
+        auto const &claimed = pending[head];
+        return start <= claimed.starting_offset ||
+               start >= claimed.ending_offset;
+    }
+
+    void operator()(size_t starting_offset, size_t ending_offset) {
+        if (!could_pass_on(starting_offset)) {
+            return;
+        }
+        // they come in roughly by start and end, so mostly this is the
+        // back, or right after it
+        if (head == pending.size() ||
+            pending.back().starting_offset < starting_offset) {
+            pending.push_back({starting_offset, ending_offset});
+            return;
+        }
+        auto it = std::lower_bound(pending.begin() + (ptrdiff_t)head,
+                                   pending.end(), starting_offset,
+                                   [](Result const &match, size_t start) {
+                                       return match.starting_offset < start;
+                                   });
+        if (it->starting_offset == starting_offset) {
+            it->ending_offset = std::max(it->ending_offset, ending_offset);
+            return;
+        }
+        pending.insert(it, {starting_offset, ending_offset});
+    }
+
+    // nothing reported from now on starts before frontier, so every
+    // candidate before it is as long as it gets and goes to sink. a
+    // candidate right at frontier is claimed if it's going to be passed
+    // on: the start is the oldest left and nothing before it is in the way
+    template <typename Sink>
+    void settle(size_t frontier, Sink &&sink) {
+        for (; head < pending.size() &&
+               pending[head].starting_offset < frontier;
+             ++head) {
+            auto const &match = pending[head];
+            if (match.starting_offset >= cursor) {
+                sink(match.starting_offset, match.ending_offset);
+                cursor = match.ending_offset;
+            }
+        }
+        if (head == pending.size()) {
+            pending.clear();
+            head = 0;
+        } else if (head > pending.size() / 2) {
+            pending.erase(pending.begin(), pending.begin() + (ptrdiff_t)head);
+            head = 0;
+        }
+        head_claimed = head < pending.size() &&
+                       pending[head].starting_offset == frontier &&
+                       frontier >= cursor;
+    }
+
+    // the input is over, whatever is left is settled
+    template <typename Sink>
+    void finish(Sink &&sink) {
+        settle(std::numeric_limits<size_t>::max(), sink);
+    }
+};
+
+// sinks with narrow offsets say how much input they can take, the matchers
+// check it once per input rather than once per match
+template <typename Sink>
+void check_sink_capacity(size_t input_size) {
+    using S = std::remove_cvref_t<Sink>;
+    if constexpr (requires { S::max_input_size; }) {
+        if (input_size > S::max_input_size) {
+            throw std::runtime_error("input too large for the sink's offsets");
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// build with -DREGEX_STATS=1 (make STATS=1) to turn the counters on. when
+// off, every counter update sits behind an `if constexpr` and compiles away
+#ifndef REGEX_STATS
+#define REGEX_STATS 0
+#endif
+
+inline constexpr bool STATS_ENABLED = REGEX_STATS;
+
+struct MatcherStats {
+    size_t bytes_scanned = 0;
+    size_t lines = 0;
+    size_t threads_started = 0;
+    size_t peak_active_threads = 0;
+    // threads that reached the same states as an older one and got folded
+    // into it
+    size_t threads_merged = 0;
+    // (state, char) pairs followed, and states a thread stepped from
+    size_t transitions_taken = 0;
+    size_t states_touched = 0;
+    size_t matches_emitted = 0;
+
+    uint64_t compile_ns = 0;
+    uint64_t scan_ns = 0;
+
+    MatcherStats &operator+=(MatcherStats const &other) {
+        bytes_scanned += other.bytes_scanned;
+        lines += other.lines;
+        threads_started += other.threads_started;
+        threads_merged += other.threads_merged;
+        peak_active_threads =
+            std::max(peak_active_threads, other.peak_active_threads);
+        transitions_taken += other.transitions_taken;
+        states_touched += other.states_touched;
+        matches_emitted += other.matches_emitted;
+        compile_ns += other.compile_ns;
+        scan_ns += other.scan_ns;
+        return *this;
+    }
+};
+
+// adds the time spent in its scope to the counter, a no-op without stats
+class StatsTimer {
+    uint64_t *target;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit StatsTimer(uint64_t &target) : target(&target) {
+        if constexpr (STATS_ENABLED) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    StatsTimer(StatsTimer const &) = delete;
+    StatsTimer &operator=(StatsTimer const &) = delete;
+
+    ~StatsTimer() {
+        if constexpr (STATS_ENABLED) {
+            *target += (uint64_t)std::chrono::duration_cast<
+                           std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+        }
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &os, MatcherStats const &stats) {
+    os << "bytes scanned: " << stats.bytes_scanned << std::endl;
+    os << "lines: " << stats.lines << std::endl;
+    os << "threads started: " << stats.threads_started << std::endl;
+    os << "threads merged: " << stats.threads_merged << std::endl;
+    os << "peak active threads: " << stats.peak_active_threads << std::endl;
+    os << "transitions taken: " << stats.transitions_taken << std::endl;
+    os << "states touched: " << stats.states_touched << std::endl;
+    os << "matches emitted: " << stats.matches_emitted << std::endl;
+    os << "compile ns: " << stats.compile_ns << std::endl;
+    os << "scan ns: " << stats.scan_ns << std::endl;
+    return os;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "compiled_regex.h"
+#include "lazy_dfa.h"
+#include "matcher.h"
+#include "sink.h"
+#include "stats.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// push-style matching over input that arrives in pieces, e.g. straight off a
+// socket. the threads still in flight carry over from one feed() to the
+// next, so matches can straddle chunk boundaries without the chunks ever
+// getting glued back together, and memory stays constant however long the
+// stream runs. all offsets are absolute within the stream
+class StreamMatcher {
+    Scanner scanner;
+
+    // absolute offset of the next byte to come in
+    size_t stream_offset = 0;
+    // the byte right before it, if there was one
+    char last_byte = '\0';
+
+    // with buffer anchors $ can sit before a newline only if that newline is
+    // the last byte of the stream. these are the matches it would give,
+    // held back until it's clear no more bytes follow
+    std::vector<Result> pending_eol;
+
+    // literals don't run on threads, so the last few bytes are kept around
+    // instead, enough to find a literal that started in the previous chunk
+    std::string literal_tail;
+    std::string literal_boundary;
+    size_t literal_overlap = 0;
+
+    bool literal_engine() const {
+        return !needs_table(scanner.get_analysis());
+    }
+
+    bool at_line_start(std::string_view chunk, size_t chunk_idx) const {
+        if (stream_offset + chunk_idx == 0) {
+            return true;
+        }
+        char prev_byte = chunk_idx > 0 ? chunk[chunk_idx - 1] : last_byte;
+        return prev_byte == '\n' && scanner.newlines_are_anchors();
+    }
+
+    // where the next thread could start once an anchored pattern has run
+    // out, or the end of the chunk if that's in a later one
+    size_t next_line_start(std::string_view chunk, size_t chunk_idx) const {
+        if (!scanner.newlines_are_anchors()) {
+            return chunk.size();
+        }
+        size_t next_newl = chunk.find('\n', chunk_idx);
+        return next_newl == std::string_view::npos ? chunk.size()
+                                                   : next_newl + 1;
+    }
+
+    template <typename F>
+    void feed_literals(std::string_view chunk, F &&on_match) {
+        auto const &searcher = scanner.regex->get_literal_searcher();
+        if (!literal_tail.empty()) {
+            // only what starts in the tail and ends in this chunk, the rest
+            // was reported last time or is about to be
+            size_t tail_begin = stream_offset - literal_tail.size();
+            literal_boundary = literal_tail;
+            literal_boundary.append(
+                chunk.substr(0, std::min(chunk.size(), literal_overlap)));
+            searcher.for_each_match(
+                literal_boundary,
+                [this, tail_begin, &on_match](size_t starting_offset,
+                                              size_t ending_offset) {
+                    if (starting_offset < literal_tail.size() &&
+                        ending_offset > literal_tail.size()) {
+                        on_match(tail_begin + starting_offset,
+                                 tail_begin + ending_offset);
+                    }
+                });
+        }
+        searcher.for_each_match(
+            chunk, [this, &on_match](size_t starting_offset,
+                                     size_t ending_offset) {
+                on_match(stream_offset + starting_offset,
+                         stream_offset + ending_offset);
+            });
+
+        if (chunk.size() >= literal_overlap) {
+            literal_tail.assign(chunk.substr(chunk.size() - literal_overlap));
+        } else {
+            literal_tail.append(chunk);
+            if (literal_tail.size() > literal_overlap) {
+                literal_tail.erase(0, literal_tail.size() - literal_overlap);
+            }
+        }
+    }
+
+    template <typename F>
+    void feed_threads(std::string_view chunk, F &&on_match) {
+        auto &lane = scanner.main_lane;
+        size_t chunk_idx = 0;
+        while (chunk_idx < chunk.size()) {
+            // a byte follows, so the last one wasn't the end of the stream
+            pending_eol.clear();
+
+            size_t curr_idx = stream_offset + chunk_idx;
+            if (at_line_start(chunk, chunk_idx)) {
+                scanner.begin_line(lane, curr_idx, on_match);
+            }
+            if (!scanner.spawn_threads() && Scanner::lane_idle(lane)) {
+                // nothing can start before the next line, skip ahead
+                chunk_idx = next_line_start(chunk, chunk_idx);
+                continue;
+            }
+            scanner.keep_cache_in_budget({&lane, 1});
+
+            char char_to_match = chunk[chunk_idx];
+            auto hold_back = [this](size_t starting_offset,
+                                    size_t ending_offset) {
+                pending_eol.push_back({starting_offset, ending_offset});
+            };
+            // the end of the stream only shows up in finish()
+            if (scanner.newlines_are_anchors()) {
+                scanner.step(lane, char_to_match, curr_idx,
+                             char_to_match == '\n', on_match);
+            } else {
+                scanner.step(lane, char_to_match, curr_idx,
+                             char_to_match == '\n', on_match, hold_back);
+            }
+            ++chunk_idx;
+        }
+    }
+
+  public:
+    explicit StreamMatcher(CompiledRegexPtr compiled_regex,
+                           DFACacheConfig dfa_cache_config = {},
+                           ScanOptions scan_options = {})
+        : scanner(std::move(compiled_regex), dfa_cache_config,
+                  scan_options) {
+        for (auto const &literal : scanner.get_analysis().literals) {
+            literal_overlap = std::max(literal_overlap, literal.size() - 1);
+        }
+    }
+
+    explicit StreamMatcher(std::string_view pattern,
+                           CompileOptions options = {},
+                           DFACacheConfig dfa_cache_config = {},
+                           ScanOptions scan_options = {})
+        : StreamMatcher(compile_regex(pattern, options), dfa_cache_config,
+                        scan_options) {}
+
+    // how many bytes went in so far
+    size_t offset() const {
+        return stream_offset;
+    }
+
+    Scanner const &get_scanner() const {
+        return scanner;
+    }
+
+    // calls on_match(starting_offset, ending_offset) for every match that
+    // is complete by the end of this chunk. on_match can be any of the
+    // sinks in sink.h. past one of the scanner's limits it throws
+    // LimitError and drops the stream, as reset() would
+    template <typename F>
+    void feed(std::string_view chunk, F &&on_match) {
+        if (chunk.empty()) {
+            return;
+        }
+        check_sink_capacity<F>(stream_offset + chunk.size());
+        MatcherStats &last_stats = scanner.last_stats;
+        last_stats = {};
+        scanner.steps_taken = 0;
+        size_t matches = 0;
+        auto counted_on_match = [&matches, &on_match](size_t starting_offset,
+                                                      size_t ending_offset) {
+            if constexpr (STATS_ENABLED) {
+                ++matches;
+            }
+            on_match(starting_offset, ending_offset);
+        };
+        {
+            StatsTimer scan_timer(last_stats.scan_ns);
+            if (literal_engine()) {
+                feed_literals(chunk, counted_on_match);
+            } else {
+                try {
+                    feed_threads(chunk, counted_on_match);
+                } catch (LimitError const &) {
+                    // the threads stopped halfway through the chunk
+                    reset();
+                    throw;
+                }
+            }
+        }
+        if constexpr (STATS_ENABLED) {
+            last_stats.bytes_scanned = chunk.size();
+            last_stats.matches_emitted = matches;
+            scanner.total_stats += last_stats;
+        }
+
+        stream_offset += chunk.size();
+        last_byte = chunk.back();
+    }
+
+    std::vector<Result> feed(std::string_view chunk) {
+        std::vector<Result> results;
+        feed(chunk, [&results](size_t starting_offset, size_t ending_offset) {
+            results.push_back({starting_offset, ending_offset});
+        });
+        return results;
+    }
+
+    // ends the stream, reporting whatever needed to know that it ended (the
+    // $ at the very end). the matcher is ready for a new stream afterwards
+    template <typename F>
+    void finish(F &&on_match) {
+        if (!literal_engine()) {
+            for (auto const &result : pending_eol) {
+                on_match(result.starting_offset, result.ending_offset);
+            }
+            if (stream_offset > 0 && last_byte != '\n') {
+                scanner.check_eol(scanner.main_lane, stream_offset - 1,
+                                  on_match);
+            }
+            scanner.finish_position(scanner.main_lane, stream_offset,
+                                    on_match);
+        }
+        reset();
+    }
+
+    std::vector<Result> finish() {
+        std::vector<Result> results;
+        finish([&results](size_t starting_offset, size_t ending_offset) {
+            results.push_back({starting_offset, ending_offset});
+        });
+        return results;
+    }
+
+    // drops the stream without reporting anything else
+    void reset() {
+        stream_offset = 0;
+        last_byte = '\0';
+        pending_eol.clear();
+        literal_tail.clear();
+        scanner.main_lane.active_matches.clear();
+        scanner.main_lane.dfa_threads.clear();
+        scanner.main_lane.prev_word = false;
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "CompactTable.h"
+#include "TransitionTable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <string_view>
+#include <vector>
+
+// how many times the nfa simulation over sample is in every state of
+// table, for CompactTable::place_hot_states_first(). every line gets
+// scanned the way the matcher does it, a thread starting at every byte,
+// but \b and \B are never followed, so the counts are close rather than
+// exact. that's all a layout needs
+inline std::vector<uint64_t>
+count_state_visits(CompactTable const &table,
+                   std::span<std::string_view const> sample) {
+    using StateId = CompactTable::StateId;
+    std::vector<uint64_t> visits(table.size());
+    std::vector<StateId> current;
+    std::vector<StateId> next;
+    // the byte a state was last added for, so no state gets in twice
+    std::vector<size_t> added_at(table.size());
+    size_t stamp = 0;
+
+    auto add = [&added_at, &stamp](std::vector<StateId> &states, StateId s) {
+        if (added_at[s] != stamp) {
+            added_at[s] = stamp;
+            states.push_back(s);
+        }
+    };
+
+    for (auto record : sample) {
+        bool line_start = true;
+        for (char c : record) {
+            ++stamp;
+            if (line_start) {
+                current.clear();
+                for (auto s : table.starting_states()) {
+                    add(current, s);
+                }
+                table.close_over(BOL_SYMBOL, current);
+                line_start = false;
+            }
+            if (c == '\n') {
+                line_start = true;
+                continue;
+            }
+            for (auto s : current) {
+                added_at[s] = stamp;
+            }
+            for (auto s : table.starting_states()) {
+                add(current, s);
+            }
+
+            ++stamp;
+            next.clear();
+            for (auto s : current) {
+                ++visits[s];
+                for (auto target : table.get_transition(s, c)) {
+                    add(next, target);
+                }
+            }
+            current.swap(next);
+        }
+    }
+    return visits;
+}
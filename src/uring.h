@@ -0,0 +1,195 @@
+#pragma once
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// just enough of io_uring to queue reads and wait for them, straight on
+// the syscalls so there's no liburing to depend on. the kernel and this
+// side share the two rings, and every head and tail the other side writes
+// gets read with acquire and every one it reads gets written with release
+class Uring {
+  public:
+    struct Completion {
+        uint64_t user_data;
+        // bytes read, or -errno
+        int32_t result;
+    };
+
+  private:
+    int ring_fd = -1;
+    void *rings = MAP_FAILED;
+    size_t rings_size = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    [[noreturn]] static void fail(char const *what) {
+        throw std::runtime_error(std::string("io_uring ") + what + ": " +
+                                 strerror(errno));
+    }
+
+    static unsigned load_acquire(unsigned *p) {
+        return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+    }
+
+    static void store_release(unsigned *p, unsigned value) {
+        std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        while (true) {
+            long done = syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                min_complete, flags, nullptr, 0);
+            if (done >= 0) {
+                return (int)done;
+            }
+            if (errno != EINTR) {
+                fail("enter");
+            }
+        }
+    }
+
+    // whether the kernel knows opcode. the probe came in 5.6, like
+    // IORING_OP_READ did, so a kernel without it can't read either
+    bool supports(uint8_t opcode) const {
+        // room for every opcode there can be, aligned for the header
+        constexpr unsigned MAX_OPS = 256;
+        std::vector<uint64_t> storage(
+            (sizeof(io_uring_probe) + MAX_OPS * sizeof(io_uring_probe_op)) /
+                sizeof(uint64_t) +
+            1);
+        auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+                    probe, MAX_OPS) < 0) {
+            return false;
+        }
+        return opcode <= probe->last_op && opcode < probe->ops_len &&
+               (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    void release() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (rings != MAP_FAILED) {
+            munmap(rings, rings_size);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+  public:
+    // throws std::runtime_error where io_uring isn't there or can't read,
+    // old kernels and sandboxes that filter it out
+    explicit Uring(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0) {
+            fail("setup");
+        }
+        // both rings in one mapping, every kernel since 5.4 does that
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            close(ring_fd);
+            errno = ENOTSUP;
+            fail("setup");
+        }
+        // 5.1 to 5.5 set up rings fine but fail every read with EINVAL
+        if (!supports(IORING_OP_READ)) {
+            close(ring_fd);
+            errno = ENOTSUP;
+            fail("read");
+        }
+
+        size_t sq_size =
+            params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        rings_size = std::max(sq_size, cq_size);
+        rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        if (rings != MAP_FAILED) {
+            sqes = static_cast<io_uring_sqe *>(
+                mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        }
+        if (rings == MAP_FAILED || sqes == MAP_FAILED) {
+            int saved = errno;
+            release();
+            errno = saved;
+            fail("mmap");
+        }
+
+        auto *base = static_cast<char *>(rings);
+        sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    }
+
+    Uring(Uring const &) = delete;
+    Uring &operator=(Uring const &) = delete;
+
+    ~Uring() {
+        release();
+    }
+
+    // queues a read of len bytes from fd into buf and hands it to the
+    // kernel. offset -1 reads from the current position, the only thing
+    // pipes can do. the caller never has more reads in flight than the
+    // ring has entries
+    void read(int fd, void *buf, unsigned len, uint64_t offset,
+              uint64_t user_data) {
+        unsigned tail = *sq_tail;
+        unsigned idx = tail & *sq_mask;
+        io_uring_sqe &sqe = sqes[idx];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buf);
+        sqe.len = len;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array[idx] = idx;
+        store_release(sq_tail, tail + 1);
+        enter(1, 0, 0);
+    }
+
+    // blocks until a read finishes, in whatever order they do
+    Completion wait() {
+        while (true) {
+            unsigned head = *cq_head;
+            if (head != load_acquire(cq_tail)) {
+                io_uring_cqe const &cqe = cqes[head & *cq_mask];
+                Completion completion{cqe.user_data, cqe.res};
+                store_release(cq_head, head + 1);
+                return completion;
+            }
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+        }
+    }
+};
@@ -0,0 +1,512 @@
+#include "compile_many.h"
+#include "empty_matches.h"
+#include "matcher.h"
+#include "parser.h"
+#include "stream_matcher.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// the bugs that got found the hard way, each one a test that would have
+// caught it. make test runs them all and fails if any does. most of them
+// only go wrong visibly under a sanitizer, so build with one now and then
+
+namespace {
+
+size_t failures = 0;
+
+void check(bool ok, std::string_view test, std::string_view what) {
+    if (!ok) {
+        ++failures;
+        std::cerr << test << ": " << what << std::endl;
+    }
+}
+
+// the same records as seen by match(), one after the other
+std::vector<BatchResult> match_each(Scanner &scanner,
+                                    std::vector<std::string_view> records) {
+    std::vector<BatchResult> results;
+    for (size_t idx = 0; idx < records.size(); ++idx) {
+        scanner.match(records[idx], [&results, idx](size_t starting_offset,
+                                                    size_t ending_offset) {
+            results.push_back(
+                {idx, starting_offset, ending_offset - starting_offset});
+        });
+    }
+    return results;
+}
+
+bool same_results(std::vector<BatchResult> a, std::vector<BatchResult> b) {
+    auto key = [](BatchResult const &r) {
+        return std::tie(r.record_idx, r.offset, r.length);
+    };
+    auto order = [&key](BatchResult const &x, BatchResult const &y) {
+        return key(x) < key(y);
+    };
+    std::sort(a.begin(), a.end(), order);
+    std::sort(b.begin(), b.end(), order);
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                      [&key](BatchResult const &x, BatchResult const &y) {
+                          return key(x) == key(y);
+                      });
+}
+
+// the same matches, in any order
+bool same_matches(std::vector<Result> a, std::vector<Result> b) {
+    auto order = [](Result const &x, Result const &y) {
+        return std::tie(x.starting_offset, x.ending_offset) <
+               std::tie(y.starting_offset, y.ending_offset);
+    };
+    std::sort(a.begin(), a.end(), order);
+    std::sort(b.begin(), b.end(), order);
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                      [](Result const &x, Result const &y) {
+                          return x.starting_offset == y.starting_offset &&
+                                 x.ending_offset == y.ending_offset;
+                      });
+}
+
+// match_interleaved checked the dfa cache budget before the lanes of a
+// group were cleared, so a cache reset read the states of threads left
+// over from the group or call before, or from an empty record. those ids
+// were stale since the reset before, a use after free
+void interleaved_lanes_start_empty() {
+    std::string_view pattern = "[^_a-ca]+|([^a-cB]\\B[a-cB1]+)BA|\\b";
+    DFACacheConfig cache{.memory_budget = 600,
+                         .min_hits_between_clears = 0,
+                         .max_thrashing_clears = 3};
+    ScanOptions scan{.whole_buffer = true, .line_anchors = true};
+    Matcher batched(pattern, {.icase = true}, cache, scan);
+    Matcher single(pattern, {.icase = true}, {}, scan);
+
+    std::vector<std::string_view> records = {
+        " Ab_baBaA A_ba\nc_ _bc1c11bBbabcb1A \nB",
+        "",
+        "1b1abbB_A1cca1",
+        "B1 Ba",
+        " AcAc1B11A1 _11A 1A_cBAcba\n caBa",
+    };
+    auto expected = match_each(single, records);
+    for (int call = 0; call < 2; ++call) {
+        std::vector<BatchResult> out;
+        batched.match_batch(records, out, 3);
+        check(same_results(out, expected), "interleaved_lanes_start_empty",
+              "match_batch differs from match()");
+    }
+}
+
+// parse() let through any byte, but the table only has rows for chars below
+// 127. anything past that indexed past a row, 0x7f threw out_of_range from
+// the table, and a range up to it never stopped compiling
+void unsupported_bytes_fail_to_parse() {
+    struct Case {
+        std::string_view pattern;
+        size_t offset;
+    };
+    Case cases[] = {{"caf\xc3\xa9", 3}, {"a\x7f*", 1},
+                    {"[!-\x7f]", 3},      {"x\\\x80", 2},
+                    {"[^a-\xff]", 4},     {"(a|\x02)", 3}};
+    for (auto const &test_case : cases) {
+        try {
+            parse(test_case.pattern);
+            check(false, "unsupported_bytes_fail_to_parse", "parsed");
+        } catch (ParseError const &e) {
+            check(e.offset() == test_case.offset,
+                  "unsupported_bytes_fail_to_parse", e.what());
+        }
+    }
+    // the highest char there is still works, in a range too
+    Matcher tilde("[}-~]");
+    check(tilde.count("a~b}") == 2, "unsupported_bytes_fail_to_parse",
+          "[}-~] doesn't match ~ and }");
+}
+
+// the cli only printed lines with a non-empty match on them, so ^ or z*
+// selected nothing where grep selects every line. these are the lines grep
+// picks for an empty match alone
+void empty_matches_select_lines() {
+    struct Case {
+        std::string_view pattern;
+        std::string_view line;
+        bool fits;
+    };
+    Case cases[] = {{"", "", true},
+                    {"^", "ab", true},
+                    {"$", "ab", true},
+                    {"z*", "", true},
+                    {"^$", "ab", false},
+                    {"^$", "", true},
+                    {"\\b", "", false},
+                    {"\\b", " x", true},
+                    {"\\B", "", true},
+                    {"^\\b", " x", false},
+                    {"a\\b|x$|^y*", "q", true},
+                    {"q", "", false},
+                    {"a|bc", "", false},
+                    {"a||b", "", true}};
+    for (auto const &test_case : cases) {
+        EmptyMatches empty(*compile_regex(test_case.pattern));
+        check(empty.fits(test_case.line) == test_case.fits,
+              "empty_matches_select_lines",
+              std::string(test_case.pattern) + " on \"" +
+                  std::string(test_case.line) + "\"");
+    }
+}
+
+// a walk over matches() went on where the scanner happened to be after
+// any other match call in between, (3,5) after a count() here
+void stale_range_iterators_end() {
+    Scanner scanner(compile_regex("ab"));
+    std::string_view str = "ab ab ab";
+
+    auto matches = scanner.matches(str);
+    auto it = matches.begin();
+    check(it != matches.end() && it->starting_offset == 0,
+          "stale_range_iterators_end", "no first match");
+    ++it;
+    check(scanner.count(str) == 3, "stale_range_iterators_end", "count");
+    check(it == matches.end(), "stale_range_iterators_end",
+          "matches() went on after count()");
+
+    auto pieces = scanner.split(str);
+    auto piece = pieces.begin();
+    ++piece;
+    auto again = matches.begin();
+    check(piece == pieces.end(), "stale_range_iterators_end",
+          "split() went on after matches() started over");
+    check(std::ranges::distance(again, matches.end()) == 3,
+          "stale_range_iterators_end", "a new walk doesn't see every match");
+}
+
+// every start inside a run of digits stayed alive in the merged thread, and
+// each step reported all of them again, so the first match of a 32 KB run
+// took 45 s. now the starts a match covers get dropped as it grows
+void first_match_of_long_run_is_quick() {
+    std::string run(32 * 1024, '7');
+    run += " 12";
+    Scanner scanner(compile_regex("\\d+"));
+
+    auto started = std::chrono::steady_clock::now();
+    auto matches = scanner.matches(run);
+    auto it = matches.begin();
+    auto took = std::chrono::steady_clock::now() - started;
+    check(it != matches.end() && it->starting_offset == 0 &&
+              it->ending_offset == 32 * 1024,
+          "first_match_of_long_run_is_quick", "wrong first match");
+    check(took < std::chrono::seconds(1), "first_match_of_long_run_is_quick",
+          "too slow");
+    ++it;
+    check(it != matches.end() && it->starting_offset == 32 * 1024 + 1,
+          "first_match_of_long_run_is_quick", "wrong second match");
+}
+
+// a dfa cache over budget gets cleared and carries on. once the clears
+// come too close together it's thrashing, and the scanner moves its threads
+// over to the nfa for good, with the same matches either way
+void dfa_cache_stays_in_budget() {
+    // every combination of the last 8 bytes is a dfa state of its own
+    std::string_view pattern = "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)b";
+    std::string text;
+    uint32_t seed = 7;
+    for (size_t idx = 0; idx < 1500; ++idx) {
+        seed = seed * 1103515245 + 12345;
+        text += (seed >> 16) & 1 ? 'a' : 'b';
+    }
+    auto expected = Matcher(pattern).match(text);
+
+    Matcher budgeted(pattern, {},
+                     {.memory_budget = 4096,
+                      .min_hits_between_clears = 0,
+                      .max_thrashing_clears = 3});
+    check(budgeted.engine() == Engine::LAZY_DFA, "dfa_cache_stays_in_budget",
+          "not on the lazy dfa");
+    check(same_matches(budgeted.match(text), expected),
+          "dfa_cache_stays_in_budget", "a cleared cache changed the matches");
+    auto const &stats = budgeted.dfa_cache_stats();
+    check(stats.clears > 3 && stats.fallbacks == 0,
+          "dfa_cache_stays_in_budget", "never cleared, or gave up");
+
+    Matcher thrashing(pattern, {},
+                      {.memory_budget = 4096,
+                       .min_hits_between_clears = SIZE_MAX,
+                       .max_thrashing_clears = 3});
+    auto const &thrashed = thrashing.dfa_cache_stats();
+    for (int call = 0; call < 2; ++call) {
+        check(same_matches(thrashing.match(text), expected),
+              "dfa_cache_stays_in_budget", "the nfa changed the matches");
+        check(thrashed.clears == 3 && thrashed.fallbacks == 1,
+              "dfa_cache_stays_in_budget",
+              "didn't fall back after 3 thrashing clears, and only once");
+    }
+}
+
+// patterns that are nothing but literals never get a table walked: one goes
+// to memmem, several to aho-corasick. either way every occurrence still
+// gets reported, overlapping ones included
+void literals_skip_the_automaton() {
+    struct Case {
+        std::string_view pattern;
+        bool icase;
+        Engine engine;
+        std::string_view text;
+        std::vector<Result> matches;
+    };
+    Case cases[] = {
+        {"aa", false, Engine::LITERAL, "aaa b aa", {{0, 2}, {1, 3}, {6, 8}}},
+        {"aB", true, Engine::LITERAL, "ab AB x", {{0, 2}, {3, 5}}},
+        {"ab|a", false, Engine::LITERAL_ALTERNATION, "xaba",
+         {{1, 2}, {1, 3}, {3, 4}}},
+        {"foo|bar|baz", false, Engine::LITERAL_ALTERNATION, "a bazfoo",
+         {{2, 5}, {5, 8}}},
+        {"a.c", false, Engine::LAZY_DFA, "abc a c", {{0, 3}}},
+        {"^ab", false, Engine::ANCHORED_NFA, "ab ab\nab", {{0, 2}, {6, 8}}},
+    };
+    for (auto const &test_case : cases) {
+        Matcher matcher(test_case.pattern, {.icase = test_case.icase});
+        check(matcher.engine() == test_case.engine,
+              "literals_skip_the_automaton",
+              std::string(test_case.pattern) + " went to the wrong engine");
+        check(same_matches(matcher.match(test_case.text), test_case.matches),
+              "literals_skip_the_automaton",
+              std::string(test_case.pattern) + " matched wrong");
+    }
+}
+
+// a stream gets the same matches however its input is cut up, including
+// the ones that straddle a cut and the $ and \b that need the byte after it
+void stream_chunks_match_like_one_buffer() {
+    std::string_view text = "abab foo\nabbc bar\nxab\nab";
+    std::string_view patterns[] = {"abab", "foo|bar", "ab+c", "^a",
+                                   "b$", "\\bab\\b", "b\\B", "(a|b)*"};
+    for (auto pattern : patterns) {
+        auto expected = Matcher(pattern).match(text);
+        StreamMatcher stream(pattern);
+        auto label = "stream_chunks_match_like_one_buffer";
+        for (size_t cut = 0; cut <= text.size(); ++cut) {
+            stream.reset();
+            auto results = stream.feed(text.substr(0, cut));
+            for (auto result : stream.feed(text.substr(cut))) {
+                results.push_back(result);
+            }
+            for (auto result : stream.finish()) {
+                results.push_back(result);
+            }
+            check(same_matches(results, expected), label,
+                  std::string(pattern) + " cut at " + std::to_string(cut));
+        }
+
+        stream.reset();
+        std::vector<Result> results;
+        for (size_t idx = 0; idx < text.size(); ++idx) {
+            for (auto result : stream.feed(text.substr(idx, 1))) {
+                results.push_back(result);
+            }
+        }
+        for (auto result : stream.finish()) {
+            results.push_back(result);
+        }
+        check(same_matches(results, expected), label,
+              std::string(pattern) + " a byte at a time");
+    }
+}
+
+// a scan charges every thread it steps, and throws the moment it's over
+// either limit. the scanner is fine to use again after that
+void scans_stop_at_their_limits() {
+    auto label = "scans_stop_at_their_limits";
+    // a thread at every depth, and none of them ever merge
+    Matcher threads("aaaaaaaa[yz]", {}, {}, {.max_active_threads = 4});
+    try {
+        threads.match("aaaaaaaaaaaa");
+        check(false, label, "no thread limit");
+    } catch (LimitError const &e) {
+        check(e.kind() == LimitError::Kind::ACTIVE_THREADS &&
+                  e.limit() == 4 && e.offset() == 4,
+              label, e.what());
+    }
+
+    Matcher steps("x+", {}, {}, {.max_steps = 50});
+    std::string text(100, 'x');
+    try {
+        steps.match(text);
+        check(false, label, "no step limit");
+    } catch (LimitError const &e) {
+        check(e.kind() == LimitError::Kind::STEPS && e.limit() == 50 &&
+                  e.offset() < text.size(),
+              label, e.what());
+    }
+    steps.set_options({});
+    check(steps.count(text) == 100 * 101 / 2, label,
+          "wrong matches after a throw");
+
+    // literals never step a thread
+    Matcher literal("xx", {}, {}, {.max_active_threads = 0, .max_steps = 0});
+    check(literal.count(text) == 99, label, "a literal got charged");
+}
+
+// the optimizer only rewrites the pattern into fewer states, the matches
+// have to stay the same
+void optimizer_keeps_the_matches() {
+    std::string_view text = "abc abcd aab ba\nfoobar foo xxx x ab\nabab";
+    std::string_view patterns[] = {
+        "a|ab|abc", "(a|a)*b", "[ab]|[bc]", "(ab)*(ab)*", "x?x?x",
+        "(a|b|c)+d", "^(foo|foobar)$", "(ab|ac|ad)", "\\b(ab|a)\\b",
+        "((a)|(b))((a)|(b))", "(x*)*y|x", "[a-c][b-d]*",
+    };
+    for (auto pattern : patterns) {
+        Matcher plain(pattern, {.optimize = false});
+        Matcher optimized(pattern);
+        check(same_matches(optimized.match(text), plain.match(text)),
+              "optimizer_keeps_the_matches", pattern);
+    }
+}
+
+// a pattern that fails only fails itself, and the combined regex matches
+// wherever any of the ones that compiled does, on any number of threads
+void compile_many_keeps_going() {
+    auto label = "compile_many_keeps_going";
+    std::string_view patterns[] = {"ab+", "(", "c|d", "x*y", "a**", "bc"};
+    std::string_view text = "abb cd xxy bc";
+    for (size_t threads : {1, 4}) {
+        auto set = compile_many(patterns,
+                                {.threads = threads, .combined = true});
+        check(set.patterns.size() == 6 && set.failed() == 2, label,
+              "wrong number of failures");
+        std::vector<Result> expected;
+        for (size_t idx = 0; idx < set.patterns.size(); ++idx) {
+            auto const &pattern = set.patterns[idx];
+            bool bad = idx == 1 || idx == 4;
+            check(pattern.ok() != bad && !pattern.regex == bad, label,
+                  std::string(patterns[idx]) + " went the wrong way");
+            if (!bad) {
+                auto matches = Scanner(pattern.regex).match(text);
+                expected.insert(expected.end(), matches.begin(),
+                                matches.end());
+            }
+        }
+        check(set.combined != nullptr, label, "no combined regex");
+        if (set.combined) {
+            auto combined = Scanner(set.combined).match(text);
+            check(same_matches(combined, expected), label,
+                  "the combined regex matches differently");
+        }
+    }
+}
+
+// replace_all swaps out the leftmost longest matches, never overlapping,
+// and keeps everything in between as it was
+void replace_all_output() {
+    struct Case {
+        std::string_view pattern;
+        std::string_view text;
+        std::string_view replacement;
+        std::string_view expected;
+    };
+    Case cases[] = {
+        {"\\d+", "a12b345c", "<$0>", "a<12>b<345>c"},
+        {"a|ab", "xaab", "[$0]", "x[a][ab]"},
+        {"aa", "aaaaa", "-", "--a"},
+        {"b", "abc", "$$", "a$c"},
+        {"x*", "axxb", "<$0>", "a<xx>b"},
+        {"^a", "ab\nab", "X", "Xb\nXb"},
+        {"z", "abc", "-", "abc"},
+        {"a", "", "-", ""},
+    };
+    for (auto const &test_case : cases) {
+        Matcher matcher(test_case.pattern);
+        check(matcher.replace_all(test_case.text, test_case.replacement) ==
+                  test_case.expected,
+              "replace_all_output", test_case.pattern);
+    }
+
+    Matcher words("[a-z]+");
+    std::string out = "> ";
+    words.replace_all(
+        "ab cd",
+        [](std::string_view match, std::string &out) {
+            out.append(match.rbegin(), match.rend());
+        },
+        out);
+    check(out == "> ba dc", "replace_all_output", "custom replacer");
+}
+
+// split gives the pieces between the leftmost longest matches: one more
+// than there are matches, empty ones included, and the matches() range
+// walks the same matches
+void split_output() {
+    struct Case {
+        std::string_view pattern;
+        std::string_view text;
+        std::vector<std::string_view> pieces;
+    };
+    Case cases[] = {
+        {",", "a,b,,c", {"a", "b", "", "c"}},
+        {" +", " a  b ", {"", "a", "b", ""}},
+        {"ab|a", "xabyaz", {"x", "y", "z"}},
+        {"\\d+", "12", {"", ""}},
+        {"z", "abc", {"abc"}},
+        {"z", "", {""}},
+        {"x*", "axb", {"a", "b"}},
+    };
+    for (auto const &test_case : cases) {
+        Scanner scanner(compile_regex(test_case.pattern));
+        std::vector<std::string_view> pieces;
+        for (auto piece : scanner.split(test_case.text)) {
+            pieces.push_back(piece);
+        }
+        check(pieces == test_case.pieces, "split_output",
+              test_case.pattern);
+
+        std::vector<Result> walked;
+        for (auto match : scanner.matches(test_case.text)) {
+            walked.push_back(match);
+        }
+        std::vector<Result> picked;
+        scanner.match_leftmost_longest(
+            test_case.text,
+            [&picked](size_t starting_offset, size_t ending_offset) {
+                picked.push_back({starting_offset, ending_offset});
+            });
+        check(same_matches(walked, picked) &&
+                  walked.size() + 1 == pieces.size(),
+              "split_output", std::string(test_case.pattern) + " matches()");
+    }
+}
+
+} // namespace
+
+int main() {
+    try {
+        interleaved_lanes_start_empty();
+        unsupported_bytes_fail_to_parse();
+        empty_matches_select_lines();
+        stale_range_iterators_end();
+        first_match_of_long_run_is_quick();
+        dfa_cache_stays_in_budget();
+        literals_skip_the_automaton();
+        stream_chunks_match_like_one_buffer();
+        scans_stop_at_their_limits();
+        optimizer_keeps_the_matches();
+        compile_many_keeps_going();
+        replace_all_output();
+        split_output();
+    } catch (std::exception const &e) {
+        ++failures;
+        std::cerr << "uncaught: " << e.what() << std::endl;
+    }
+    if (failures > 0) {
+        std::cerr << failures << " failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all passed" << std::endl;
+    return 0;
+}